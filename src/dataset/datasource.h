@@ -1,9 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
 #include <spdlog/spdlog.h>
 
 #include <arrow/record_batch.h>
 #include <parquet/arrow/reader.h>
+#include <parquet/exception.h>
 
 #include "dataset/dataset.h"
 #include "utils/file_reader.h"
@@ -13,120 +18,265 @@ namespace pgvectorbench {
 
 class DataSource {
 public:
-  DataSource(const DataSet *dataset, size_t batch_size, size_t thread_num)
+  DataSource(const DataSet *dataset, size_t batch_size, size_t thread_num,
+             bool pin_threads = false)
       : dataset_(dataset), batch_size_(batch_size), thread_num_(thread_num) {
     assert(batch_size_ > 0);
     assert(thread_num > 0);
 
-    thread_pool_ = std::make_unique<ThreadPool>(thread_num);
+    thread_pool_ = std::make_unique<ThreadPool>(thread_num, pin_threads);
   }
 
   virtual ~DataSource() = default;
 
   virtual void start() = 0;
 
-  virtual void wait_for_finish() { thread_pool_->wait_all_tasks_finished(); }
+  virtual void wait_for_finish() {
+    thread_pool_->wait();
+    if (io_ns_.load() > 0 || convert_ns_.load() > 0) {
+      SPDLOG_INFO("waited {:.2f}s on io, spent {:.2f}s converting and waited "
+                  "{:.2f}s handing blocks off, summed over {} workers",
+                  io_ns_.load() / 1e9,
+                  (convert_ns_.load() - handoff_ns_.load()) / 1e9,
+                  handoff_ns_.load() / 1e9, thread_num_);
+    }
+  }
+
+  // convert callbacks report the time they were blocked handing their rows
+  // off, e.g. on a full queue, so that it is not counted as converting
+  void add_handoff_ns(int64_t ns) { handoff_ns_.fetch_add(ns); }
 
 protected:
+  static int64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
   const DataSet *dataset_;
   size_t batch_size_;
   size_t thread_num_;
 
+  // time workers spent waiting for data, which includes decoding for
+  // parquet, and in convert, of which handoff_ns_ was spent blocked
+  std::atomic<int64_t> io_ns_{0};
+  std::atomic<int64_t> convert_ns_{0};
+  std::atomic<int64_t> handoff_ns_{0};
+
   std::unique_ptr<ThreadPool> thread_pool_;
 };
 
 template <typename DataType> class VecsDataSource : public DataSource {
 public:
   VecsDataSource(const DataSet *dataset, size_t batch_size, size_t thread_num,
-                 std::function<bool(VecsBlock *block)> const &convert)
-      : DataSource(dataset, batch_size, thread_num), convert_(convert) {}
+                 std::function<bool(VecsBlock *block)> const &convert,
+                 util::ReadOptions read_options = util::ReadOptions(),
+                 bool pin_threads = false)
+      : DataSource(dataset, batch_size, thread_num, pin_threads),
+        convert_(convert), read_options_(read_options) {}
 
   ~VecsDataSource() override = default;
 
+  /*
+   * Blocks are not enqueued up front, each worker claims the next one from a
+   * shared cursor until all files are consumed, so scheduling costs one task
+   * per worker and memory is bounded by the read buffers of the workers
+   * whatever the size of the base files.
+   *
+   * A worker claims its next block before converting the current one and
+   * reads it ahead, so that the disk reads of the next block overlap with
+   * converting this one. In uring mode the read is submitted to the ring of
+   * the worker into the second of its two buffers and reaped on the next
+   * iteration. Otherwise the kernel is asked to read the block ahead
+   * (fadvise or madvise WILLNEED) and the read itself stays synchronous.
+   */
   void start() override {
-
     // size of dimension(which is uint32_t) + size of vector
-    size_t rowsize = (sizeof(uint32_t) + dataset_->dim_ * sizeof(DataType));
-    size_t step = rowsize * batch_size_;
-    size_t buffersize = step;
+    rowsize_ = (sizeof(uint32_t) + dataset_->dim_ * sizeof(DataType));
+    step_ = rowsize_ * batch_size_;
     size_t total_row = 0; // accumuted row count for all base files
 
-    // pre alloc some buffer, each thread use one as read buffer
-    for (auto i = 0; i < thread_num_; i++) {
-      buffers_.push_back(std::string(buffersize, ' '));
+    // pre alloc the read buffers of the workers, aligned so that O_DIRECT
+    // reads land in them without a copy, blocks point directly into the
+    // mapping in mmap mode
+    read_ahead_ =
+        read_options_.prefetch && read_options_.mode == util::ReadMode::URING;
+    if (read_options_.mode != util::ReadMode::MMAP) {
+      for (size_t i = 0; i < thread_num_ * (read_ahead_ ? 2 : 1); i++) {
+        buffers_.push_back(util::FileReader::alignedBuffer(step_));
+      }
     }
 
     for (const auto &base_file : dataset_->base_files_) {
       auto file_path = dataset_->location_ + base_file.first;
       std::shared_ptr<util::FileReader> reader =
-          std::make_shared<util::FileReader>(file_path);
+          std::make_shared<util::FileReader>(file_path, read_options_);
       reader->open();
-      readers.push_back(reader);
 
-      size_t begin = 0;
       size_t filesize = reader->filesize();
-      assert(filesize == base_file.second * rowsize);
-      while (begin + step < filesize) {
-
-        // NB: pass reader pointer to lamda here
-        thread_pool_->enqueue([&, begin, step, total_row, rd = reader.get()]() {
-          auto thread_id_ = get_thread_id();
-          assert(thread_id_ < thread_num_);
-
-          SPDLOG_DEBUG("read {} begin: {}, step {}, thread_id {}",
-                       blocks.fetch_add(1), begin, step, thread_id_);
-          char *buffer = buffers_[thread_id_].data();
-          rd->read(buffer, step, begin);
-
-          VecsBlock block(buffer, total_row, batch_size_, dataset_);
-          if (!convert_(&block)) {
-            failed_block_num.fetch_add(1);
-            SPDLOG_ERROR("bad convertion begin pos: {}, length: {}", begin,
-                         step);
-          }
-        });
-        begin += step;
-        total_row += batch_size_;
-      }
+      assert(filesize == base_file.second * rowsize_);
+      files_.push_back({reader, total_blocks_, total_row});
+      total_blocks_ += (filesize + step_ - 1) / step_;
+      total_row += filesize / rowsize_;
+    }
+    assert(total_row == dataset_->total_cnt_);
+    SPDLOG_INFO("{} blocks of {} rows in {} files, claimed by {} workers",
+                total_blocks_, batch_size_, files_.size(), thread_num_);
+
+    // the worker index owns the read buffers, blocks are claimed in file
+    // order so that reads stay mostly sequential
+    std::vector<ThreadPool::Task> tasks;
+    for (size_t i = 0; i < thread_num_; i++) {
+      tasks.emplace_back([this](size_t worker) { run(worker); });
+    }
+    thread_pool_->submit(std::move(tasks));
+  }
+
+  void wait_for_finish() override {
+    DataSource::wait_for_finish();
+    SPDLOG_INFO("read {} blocks, {} failed to convert", total_blocks_,
+                failed_block_num.load());
+  }
+
+  // blocks not yet claimed by any worker
+  size_t pending_blocks() const {
+    size_t claimed = std::min(next_block_.load(), total_blocks_);
+    return total_blocks_ - claimed;
+  }
+
+private:
+  struct BaseFile {
+    std::shared_ptr<util::FileReader> reader;
+    size_t first_block; // index of its first block over all files
+    size_t first_row;   // id of its first row
+  };
+
+  struct BlockRange {
+    util::FileReader *reader;
+    size_t begin;
+    size_t step;
+    size_t first_row;
+  };
+
+  // where block b lies in the base files
+  BlockRange locate(size_t b) const {
+    auto it = std::upper_bound(
+        files_.begin(), files_.end(), b,
+        [](size_t block, const BaseFile &f) { return block < f.first_block; });
+    const BaseFile &file = *(it - 1);
+    size_t nth = b - file.first_block;
+    size_t begin = nth * step_;
+    return {file.reader.get(), begin,
+            std::min(step_, file.reader->filesize() - begin),
+            file.first_row + nth * batch_size_};
+  }
+
+  // the next unclaimed block, read ahead if prefetch is enabled, total_blocks_
+  // once there are none left
+  size_t claim() {
+    size_t b = next_block_.fetch_add(1);
+    if (b >= total_blocks_) {
+      return total_blocks_;
+    }
+    size_t in_flight = in_flight_.fetch_add(1) + 1;
+    if (b > 0 && b % std::max<size_t>(total_blocks_ / 10, 1) == 0) {
+      SPDLOG_INFO("claimed {}/{} blocks, {} pending, {} in flight", b,
+                  total_blocks_, total_blocks_ - b, in_flight);
+    }
+    if (read_options_.prefetch && !read_ahead_) {
+      BlockRange range = locate(b);
+      range.reader->prefetch(range.begin, range.step);
+    }
+    return b;
+  }
 
-      // last block
-      assert(begin < filesize);
-      // NB: pass reader pointer to lamda here
-      thread_pool_->enqueue([&, begin, step = filesize - begin, total_row,
-                             rowsize, rd = reader.get()]() {
-        auto thread_id_ = get_thread_id();
-        assert(thread_id_ < thread_num_);
-
-        SPDLOG_DEBUG("read {} begin: {}, step {}", blocks.fetch_add(1), begin,
-                     step);
-        char *buffer = buffers_[thread_id_].data();
-        rd->read(buffer, step, begin);
-        VecsBlock block(buffer, total_row, step / rowsize, dataset_);
-        if (!convert_(&block)) {
-          failed_block_num.fetch_add(1);
-          SPDLOG_ERROR("bad convertion begin pos: {}, length: {}", begin, step);
+  // claim, read and convert blocks until there are none left
+  void run(size_t worker) {
+    size_t b = claim();
+    const char *pending = nullptr; // where the submitted read of b lands
+    if (b < total_blocks_ && read_ahead_) {
+      pending = start_read(worker, 0, b);
+    }
+    for (size_t slot = 0; b < total_blocks_; slot ^= 1) {
+      size_t next = claim();
+      const char *buffer;
+      if (read_ahead_) {
+        buffer = finish_read(b, pending);
+        if (next < total_blocks_) {
+          pending = start_read(worker, slot ^ 1, next);
         }
-      });
-      total_row += (filesize - begin) / rowsize;
+      } else {
+        buffer = fetch(worker, b);
+      }
+      convert_block(b, buffer);
+      in_flight_.fetch_sub(1);
+      b = next;
     }
+  }
 
-    assert(total_row == dataset_->total_cnt_);
+  void convert_block(size_t b, const char *buffer) {
+    BlockRange range = locate(b);
+    auto start = std::chrono::steady_clock::now();
+    VecsBlock block(buffer, range.first_row, range.step / rowsize_, dataset_);
+    if (!convert_(&block)) {
+      failed_block_num.fetch_add(1);
+      SPDLOG_ERROR("bad convertion begin pos: {}, length: {}", range.begin,
+                   range.step);
+    }
+    convert_ns_.fetch_add(elapsed_ns(start));
   }
 
-private:
-  std::atomic<int> blocks{0};
-  std::atomic<int> cnt{0};
-  int get_thread_id() {
-    thread_local int thread_id{cnt++};
-    return thread_id;
+  // get the bytes of block b, either as a view into the mapping or read
+  // into the buffer of the worker
+  const char *fetch(size_t worker, size_t b) {
+    BlockRange range = locate(b);
+    SPDLOG_DEBUG("read block {} begin: {}, step {}, worker {}", b, range.begin,
+                 range.step, worker);
+    auto start = std::chrono::steady_clock::now();
+    const char *buffer =
+        range.reader->mapped()
+            ? range.reader->view(range.begin, range.step)
+            : range.reader->read(buffers_[worker].get(), range.step,
+                                 range.begin);
+    io_ns_.fetch_add(elapsed_ns(start));
+    return buffer;
+  }
+
+  // submit the read of block b into buffer slot of the worker and return
+  // where it lands, finish_read waits for it
+  const char *start_read(size_t worker, size_t slot, size_t b) {
+    BlockRange range = locate(b);
+    SPDLOG_DEBUG("read block {} begin: {}, step {}, worker {}, slot {}", b,
+                 range.begin, range.step, worker, slot);
+    auto start = std::chrono::steady_clock::now();
+    const char *buffer = range.reader->readAsync(
+        buffers_[worker * 2 + slot].get(), range.step, range.begin);
+    io_ns_.fetch_add(elapsed_ns(start));
+    return buffer;
+  }
+
+  const char *finish_read(size_t b, const char *buffer) {
+    auto start = std::chrono::steady_clock::now();
+    locate(b).reader->wait();
+    io_ns_.fetch_add(elapsed_ns(start));
+    return buffer;
   }
 
+  size_t rowsize_{0};
+  size_t step_{0};
+  std::vector<BaseFile> files_;
+  size_t total_blocks_{0};
+  std::atomic<size_t> next_block_{0};
+  std::atomic<size_t> in_flight_{0}; // claimed and not yet converted
+
   // record how many blocks failed due to bad convertion
   std::atomic<size_t> failed_block_num{0};
 
-  std::vector<std::string> buffers_;
+  // one read buffer per worker, two with read_ahead_ laid out by worker
+  bool read_ahead_{false};
+  std::vector<util::AlignedBuffer> buffers_;
   std::function<bool(VecsBlock *block)> convert_;
-  std::vector<std::shared_ptr<util::FileReader>> readers;
+  util::ReadOptions read_options_;
 };
 
 class ParquetDataSource : public DataSource {
@@ -134,88 +284,164 @@ public:
   ParquetDataSource(const DataSet *dataset, size_t batch_size,
                     size_t thread_num,
                     std::function<bool(std::shared_ptr<arrow::RecordBatch> &,
-                                       const DataSet *)> const &convert)
-      : DataSource(dataset, batch_size, thread_num), convert_(convert) {}
+                                       const DataSet *)> const &convert,
+                    bool pin_threads = false)
+      : DataSource(dataset, batch_size, thread_num, pin_threads),
+        convert_(convert) {}
 
   ~ParquetDataSource() override = default;
 
+  /*
+   * Each row group of the base files is a task. The downloaded datasets are
+   * written as a single row group per file, so when there are fewer row
+   * groups than workers a task only decodes and hands the record batches
+   * off to the other workers to convert, at most one per worker at a time.
+   * Decoding a row group stays sequential, rewriting the files with smaller
+   * row groups (see rewrite) spreads that over the workers too.
+   */
   void start() override {
-    // // since each base file has only 1 row group, there seems no way to split
-    // // the base file further.
-    // for (const auto &base_file : dataset_->base_files_) {
-    //   auto file_path = dataset_->location_ + base_file.first;
-    //   std::unique_ptr<parquet::ParquetFileReader> parquet_reader =
-    //       parquet::ParquetFileReader::OpenFile(file_path, false);
-    //   // Get the file MetaData
-    //   std::shared_ptr<parquet::FileMetaData> file_metadata =
-    //       parquet_reader->metadata();
-    //   int num_row_groups = file_metadata->num_row_groups();
-    //   SPDLOG_INFO("{} has {} row groups", file_path, num_row_groups);
-    // }
-
+    std::vector<RowGroup> row_groups;
     for (const auto &base_file : dataset_->base_files_) {
       auto file_path = dataset_->location_ + base_file.first;
+      std::shared_ptr<parquet::FileMetaData> metadata;
+      try {
+        metadata =
+            parquet::ParquetFileReader::OpenFile(file_path, false)->metadata();
+      } catch (const parquet::ParquetException &e) {
+        SPDLOG_ERROR("open file failed: {}", e.what());
+        continue;
+      }
+      assert(static_cast<size_t>(metadata->num_rows()) == base_file.second);
+      for (int i = 0; i < metadata->num_row_groups(); i++) {
+        row_groups.push_back(
+            {file_path, i,
+             static_cast<size_t>(metadata->RowGroup(i)->num_rows())});
+      }
+    }
+    fan_out_ = row_groups.size() < thread_num_;
+    SPDLOG_INFO("{} row groups in {} files, read by {} workers{}",
+                row_groups.size(), dataset_->base_files_.size(), thread_num_,
+                fan_out_ ? ", record batches converted in parallel" : "");
+
+    std::vector<ThreadPool::Task> tasks;
+    for (const auto &row_group : row_groups) {
+      tasks.emplace_back(
+          [this, row_group](size_t) { read_row_group(row_group); });
+    }
+    thread_pool_->submit(std::move(tasks));
+  }
 
-      thread_pool_->enqueue([&, file_path, batch_size = batch_size_,
-                             file_row_num = base_file.second]() {
-        arrow::MemoryPool *pool = arrow::default_memory_pool();
-        // general Parquet reader settings
-        auto reader_properties = parquet::ReaderProperties(pool);
-        reader_properties.set_buffer_size(2048 * 1024);
-        reader_properties.enable_buffered_stream();
-
-        // Arrow-specific Parquet reader settings
-        auto arrow_reader_props = parquet::ArrowReaderProperties();
-        arrow_reader_props.set_batch_size(batch_size);
-
-        parquet::arrow::FileReaderBuilder reader_builder;
-        auto status = reader_builder.OpenFile(file_path, /*memory_map*/ false,
-                                              reader_properties);
-        if (!status.ok()) {
-          SPDLOG_ERROR("open file failed: {}", status.ToString());
-          return;
-        }
-        reader_builder.memory_pool(pool);
-        reader_builder.properties(arrow_reader_props);
-
-        std::unique_ptr<parquet::arrow::FileReader> arrow_reader;
-        status = reader_builder.Build(&arrow_reader);
-        if (!status.ok()) {
-          SPDLOG_ERROR("build arrow reader failed: {}", status.ToString());
-          return;
-        }
+private:
+  struct RowGroup {
+    std::string file_path;
+    int index;
+    size_t rows;
+  };
+
+  void read_row_group(const RowGroup &row_group) {
+    arrow::MemoryPool *pool = arrow::default_memory_pool();
+    // general Parquet reader settings
+    auto reader_properties = parquet::ReaderProperties(pool);
+    reader_properties.set_buffer_size(2048 * 1024);
+    reader_properties.enable_buffered_stream();
+
+    // Arrow-specific Parquet reader settings
+    auto arrow_reader_props = parquet::ArrowReaderProperties();
+    arrow_reader_props.set_batch_size(batch_size_);
+    // fetch the column chunks of a row group in coalesced reads issued ahead
+    // of decoding
+    arrow_reader_props.set_pre_buffer(true);
+    // decode the columns in parallel when workers would be idle otherwise
+    arrow_reader_props.set_use_threads(fan_out_);
+
+    parquet::arrow::FileReaderBuilder reader_builder;
+    auto status = reader_builder.OpenFile(row_group.file_path,
+                                          /*memory_map*/ false,
+                                          reader_properties);
+    if (!status.ok()) {
+      SPDLOG_ERROR("open file failed: {}", status.ToString());
+      return;
+    }
+    reader_builder.memory_pool(pool);
+    reader_builder.properties(arrow_reader_props);
+
+    std::unique_ptr<parquet::arrow::FileReader> arrow_reader;
+    status = reader_builder.Build(&arrow_reader);
+    if (!status.ok()) {
+      SPDLOG_ERROR("build arrow reader failed: {}", status.ToString());
+      return;
+    }
 
-        std::shared_ptr<::arrow::RecordBatchReader> rb_reader;
-        status = arrow_reader->GetRecordBatchReader(&rb_reader);
-        if (!status.ok()) {
-          SPDLOG_ERROR("get record batch reader failed: {}", status.ToString());
-          return;
-        }
+    std::shared_ptr<::arrow::RecordBatchReader> rb_reader;
+    status = arrow_reader->GetRecordBatchReader(
+        {row_group.index}, project(arrow_reader.get()), &rb_reader);
+    if (!status.ok()) {
+      SPDLOG_ERROR("get record batch reader failed: {}", status.ToString());
+      return;
+    }
 
-        size_t total_row = 0;
-        std::shared_ptr<arrow::RecordBatch> recordBatch;
-        do {
-          status = rb_reader->ReadNext(&recordBatch);
-          if (!status.ok()) {
-            SPDLOG_ERROR("read next batch failed: {}", status.ToString());
-            break;
-          }
-          if (recordBatch) {
-            if (!convert_(recordBatch, dataset_)) {
-              SPDLOG_ERROR("failed to handle recordBatch after handle {} "
-                           "number of rows");
-            }
-            total_row += recordBatch->num_rows();
+    size_t total_row = 0;
+    std::shared_ptr<arrow::RecordBatch> recordBatch;
+    do {
+      auto start = std::chrono::steady_clock::now();
+      status = rb_reader->ReadNext(&recordBatch);
+      io_ns_.fetch_add(elapsed_ns(start));
+      if (!status.ok()) {
+        SPDLOG_ERROR("read next batch failed: {}", status.ToString());
+        break;
+      }
+      if (recordBatch) {
+        total_row += recordBatch->num_rows();
+        // convert here once every worker already has a batch, which bounds
+        // the decoded batches held in memory
+        if (fan_out_ && in_flight_.fetch_add(1) < thread_num_) {
+          thread_pool_->submit([this, recordBatch](size_t) mutable {
+            convert_batch(recordBatch);
+            in_flight_.fetch_sub(1);
+          });
+        } else {
+          if (fan_out_) {
+            in_flight_.fetch_sub(1);
           }
+          convert_batch(recordBatch);
+        }
+      }
+    } while (recordBatch);
+
+    assert(total_row == row_group.rows);
+  }
 
-        } while (recordBatch);
+  // leaf columns of the id and the vector field, in that order as convert
+  // expects, the first two columns if the file names them differently
+  std::vector<int> project(parquet::arrow::FileReader *arrow_reader) const {
+    const parquet::SchemaDescriptor *schema =
+        arrow_reader->parquet_reader()->metadata()->schema();
+    std::vector<int> columns;
+    for (const auto &name : {std::string("id"), dataset_->vector_field_}) {
+      for (int i = 0; i < schema->num_columns(); i++) {
+        if (schema->GetColumnRoot(i)->name() == name) {
+          columns.push_back(i);
+        }
+      }
+    }
+    if (columns.size() != 2) {
+      return {0, 1};
+    }
+    return columns;
+  }
 
-        assert(total_row = file_row_num);
-      });
+  void convert_batch(std::shared_ptr<arrow::RecordBatch> &batch) {
+    auto start = std::chrono::steady_clock::now();
+    if (!convert_(batch, dataset_)) {
+      SPDLOG_ERROR("failed to handle record batch of {} rows",
+                   batch->num_rows());
     }
+    convert_ns_.fetch_add(elapsed_ns(start));
   }
 
-private:
+  bool fan_out_{false};
+  std::atomic<size_t> in_flight_{0}; // batches handed off, not yet converted
+
   std::function<bool(std::shared_ptr<arrow::RecordBatch> &, const DataSet *)>
       convert_;
 };
@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <type_traits>
+#include <unordered_map>
+
+#include <spdlog/spdlog.h>
+
+#include "dataset/dataset.h"
+#include "dataset/datasource.h"
+#include "utils/distance.h"
+
+namespace pgvectorbench {
+
+namespace {
+
+// base vectors handed to one task of the data source
+constexpr size_t default_gt_batch_size = 8192;
+// base vectors compared against every query before moving on, sized so that
+// a tile of typical dimension stays in L2
+constexpr size_t base_tile_size = 256;
+
+// accepts the base vectors a query may return, given their id and vector
+using BaseFilter = std::function<bool(int64_t id, const float *vec)>;
+
+// The k closest candidates seen so far, kept as a max heap on distance so
+// that the worst one can be replaced in O(log k).
+class TopK {
+public:
+  explicit TopK(size_t k) : k_(k) { heap_.reserve(k); }
+
+  void push(float distance, int64_t id) {
+    if (heap_.size() < k_) {
+      heap_.emplace_back(distance, id);
+      std::push_heap(heap_.begin(), heap_.end());
+    } else if (distance < heap_.front().first) {
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.back() = {distance, id};
+      std::push_heap(heap_.begin(), heap_.end());
+    }
+  }
+
+  void merge(const TopK &other) {
+    for (const auto &[distance, id] : other.heap_) {
+      push(distance, id);
+    }
+  }
+
+  // distances and ids of the candidates, closest first
+  std::vector<std::pair<float, int64_t>> sorted() const {
+    auto sorted = heap_;
+    std::sort_heap(sorted.begin(), sorted.end());
+    return sorted;
+  }
+
+private:
+  size_t k_;
+  std::vector<std::pair<float, int64_t>> heap_;
+};
+
+// Distances between float vectors of a dataset, smaller is closer for every
+// metric. Cosine expects the query to be normalized already.
+class Scorer {
+public:
+  explicit Scorer(const DataSet *dataset)
+      : metric_(dataset->metric_), dim_(dataset->dim_),
+        kernels_(util::distanceKernels()) {}
+
+  const char *isa() const { return kernels_.isa; }
+
+  // copy count queries, normalized if the metric needs it
+  std::vector<float> prepareQueries(const float *queries, size_t count) const {
+    std::vector<float> prepared(queries, queries + count * dim_);
+    if (metric_ == DataSetMetric::COSINE) {
+      for (size_t q = 0; q < count; q++) {
+        float *query = prepared.data() + q * dim_;
+        float inv_norm = invNorm(query);
+        std::transform(query, query + dim_, query,
+                       [inv_norm](float v) { return v * inv_norm; });
+      }
+    }
+    return prepared;
+  }
+
+  // only needed for cosine, base vectors are normalized on the fly
+  float invNorm(const float *vec) const {
+    if (metric_ != DataSetMetric::COSINE) {
+      return 1.0f;
+    }
+    float norm = std::sqrt(kernels_.inner_product(vec, vec, dim_));
+    return norm > 0.0f ? 1.0f / norm : 0.0f;
+  }
+
+  float distance(const float *query, const float *vec, float inv_norm) const {
+    switch (metric_) {
+    case DataSetMetric::L2:
+      return kernels_.l2_sqr(query, vec, dim_);
+    case DataSetMetric::IP:
+      return -kernels_.inner_product(query, vec, dim_);
+    case DataSetMetric::COSINE:
+      return 1.0f - kernels_.inner_product(query, vec, dim_) * inv_norm;
+    case DataSetMetric::L1:
+      return kernels_.l1(query, vec, dim_);
+    default:
+      return std::numeric_limits<float>::max();
+    }
+  }
+
+  // the distance as pgvector's operator reports it, L2 is kept squared while
+  // ranking
+  float operatorDistance(float distance) const {
+    return metric_ == DataSetMetric::L2 ? std::sqrt(distance) : distance;
+  }
+
+private:
+  DataSetMetric metric_;
+  size_t dim_;
+  const util::DistanceKernels &kernels_;
+};
+
+/*
+ * Exact k nearest neighbors of every query over the whole base set, or over
+ * the base vectors accepted by filter if there is one.
+ *
+ * Blocks of base vectors are scored by the data source threads, each block
+ * keeps its own top k per query and is merged into the global result once
+ * it is done, so the only lock is taken once per block.
+ */
+class GroundTruthEngine {
+public:
+  GroundTruthEngine(const DataSet *dataset, const float *queries,
+                    size_t count, size_t top_k, const BaseFilter &filter)
+      : scorer_(dataset), dim_(dataset->dim_), count_(count), top_k_(top_k),
+        queries_(scorer_.prepareQueries(queries, count)), filter_(filter),
+        results_(count_, TopK(top_k)) {}
+
+  const char *isa() const { return scorer_.isa(); }
+
+  // score nb base vectors laid out back to back, ids[i] is the id of the ith
+  void process(const float *base, const int64_t *ids, size_t nb) {
+    std::vector<float> filtered_base;
+    std::vector<int64_t> filtered_ids;
+    if (filter_) {
+      // keep the accepted vectors only, the tiles below stay dense
+      for (size_t b = 0; b < nb; b++) {
+        if (filter_(ids[b], base + b * dim_)) {
+          filtered_base.insert(filtered_base.end(), base + b * dim_,
+                               base + (b + 1) * dim_);
+          filtered_ids.push_back(ids[b]);
+        }
+      }
+      base = filtered_base.data();
+      ids = filtered_ids.data();
+      nb = filtered_ids.size();
+    }
+
+    std::vector<TopK> local(count_, TopK(top_k_));
+    std::vector<float> inv_norms;
+
+    for (size_t b0 = 0; b0 < nb; b0 += base_tile_size) {
+      size_t b1 = std::min(nb, b0 + base_tile_size);
+      inv_norms.resize(b1 - b0);
+      for (size_t b = b0; b < b1; b++) {
+        inv_norms[b - b0] = scorer_.invNorm(base + b * dim_);
+      }
+      for (size_t q = 0; q < count_; q++) {
+        const float *query = queries_.data() + q * dim_;
+        TopK &topk = local[q];
+        for (size_t b = b0; b < b1; b++) {
+          topk.push(scorer_.distance(query, base + b * dim_, inv_norms[b - b0]),
+                    ids[b]);
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t q = 0; q < count_; q++) {
+      results_[q].merge(local[q]);
+    }
+  }
+
+  // the ids of the top k neighbors of every query, sorted by id as the
+  // recall calculation expects and laid out back to back. Their distances
+  // go to distances closest first if it is given.
+  std::vector<int64_t> result(std::vector<float> *distances) const {
+    std::vector<int64_t> gts(count_ * top_k_, -1);
+    if (distances != nullptr) {
+      distances->assign(count_ * top_k_,
+                        std::numeric_limits<float>::infinity());
+    }
+    for (size_t q = 0; q < count_; q++) {
+      auto candidates = results_[q].sorted();
+      std::vector<int64_t> ids;
+      ids.reserve(candidates.size());
+      for (size_t r = 0; r < candidates.size(); r++) {
+        ids.push_back(candidates[r].second);
+        if (distances != nullptr) {
+          (*distances)[q * top_k_ + r] =
+              scorer_.operatorDistance(candidates[r].first);
+        }
+      }
+      std::sort(ids.begin(), ids.end());
+      std::copy(ids.begin(), ids.end(), gts.begin() + q * top_k_);
+    }
+    return gts;
+  }
+
+private:
+  Scorer scorer_;
+  size_t dim_;
+  size_t count_;
+  size_t top_k_;
+  std::vector<float> queries_;
+  const BaseFilter &filter_;
+
+  std::mutex mutex_;
+  std::vector<TopK> results_;
+};
+
+/*
+ * Distances between every query and its given ground truth neighbors, for
+ * ground truth files that only carry ids.
+ *
+ * The base set is streamed once, every base vector that is a neighbor of
+ * some query is scored against those queries only. Each slot is written by
+ * exactly one block, so no lock is needed.
+ */
+class GroundTruthDistances {
+public:
+  GroundTruthDistances(const DataSet *dataset, const float *queries,
+                       const int64_t *gts, size_t count, size_t top_k)
+      : scorer_(dataset), dim_(dataset->dim_), count_(count), top_k_(top_k),
+        queries_(scorer_.prepareQueries(queries, count)),
+        distances_(count * top_k, std::numeric_limits<float>::infinity()) {
+    for (size_t slot = 0; slot < count * top_k; slot++) {
+      if (gts[slot] >= 0) {
+        slots_[gts[slot]].push_back(slot);
+      }
+    }
+  }
+
+  const char *isa() const { return scorer_.isa(); }
+
+  void process(const float *base, const int64_t *ids, size_t nb) {
+    for (size_t b = 0; b < nb; b++) {
+      auto it = slots_.find(ids[b]);
+      if (it == slots_.end()) {
+        continue;
+      }
+      const float *vec = base + b * dim_;
+      float inv_norm = scorer_.invNorm(vec);
+      for (size_t slot : it->second) {
+        const float *query = queries_.data() + slot / top_k_ * dim_;
+        distances_[slot] =
+            scorer_.operatorDistance(scorer_.distance(query, vec, inv_norm));
+      }
+    }
+  }
+
+  // distances of every query's neighbors closest first, laid out back to
+  // back, neighbors missing from the base set are left infinite
+  std::vector<float> result() {
+    size_t missing = 0;
+    for (size_t q = 0; q < count_; q++) {
+      auto begin = distances_.begin() + q * top_k_;
+      std::sort(begin, begin + top_k_);
+      missing += std::count(begin, begin + top_k_,
+                            std::numeric_limits<float>::infinity());
+    }
+    if (missing > 0) {
+      SPDLOG_WARN("{} ground truth neighbors not found in the base set",
+                  missing);
+    }
+    return std::move(distances_);
+  }
+
+private:
+  Scorer scorer_;
+  size_t dim_;
+  size_t count_;
+  size_t top_k_;
+  std::vector<float> queries_;
+  std::unordered_map<int64_t, std::vector<size_t>> slots_;
+  std::vector<float> distances_;
+};
+
+// convert a block of a VECS file to floats and score it
+template <typename DataType, typename Sink>
+bool processVecsBlock(Sink &sink, VecsBlock *block) {
+  const size_t dim = block->dataset_->dim_;
+  const size_t rowsize = sizeof(uint32_t) + dim * sizeof(DataType);
+  std::vector<float> base(block->batch_size_ * dim);
+  std::vector<int64_t> ids(block->batch_size_);
+  for (size_t i = 0; i < block->batch_size_; i++) {
+    const char *row = block->buffer_ + i * rowsize;
+    if (*((uint32_t *)row) != dim) {
+      return false;
+    }
+    const DataType *vecs = (const DataType *)(row + sizeof(uint32_t));
+    std::copy(vecs, vecs + dim, base.begin() + i * dim);
+    ids[i] = block->start_id_ + i;
+  }
+  sink.process(base.data(), ids.data(), block->batch_size_);
+  return true;
+}
+
+// convert a record batch of a Parquet file to floats and score it
+template <typename DataType, typename Sink>
+bool processRecordBatch(Sink &sink, std::shared_ptr<arrow::RecordBatch> &batch,
+                        const DataSet *ds) {
+  const size_t dim = ds->dim_;
+  const size_t nb = batch->num_rows();
+  auto id_array = std::static_pointer_cast<arrow::Int64Array>(batch->column(0));
+  auto list_array =
+      std::static_pointer_cast<arrow::ListArray>(batch->column(1));
+  const DataType *values;
+  if constexpr (std::is_same_v<DataType, float>) {
+    values = std::static_pointer_cast<arrow::FloatArray>(list_array->values())
+                 ->raw_values();
+  } else {
+    values = std::static_pointer_cast<arrow::DoubleArray>(list_array->values())
+                 ->raw_values();
+  }
+
+  std::vector<float> base(nb * dim);
+  std::vector<int64_t> ids(nb);
+  for (size_t i = 0; i < nb; i++) {
+    size_t begin = list_array->value_offset(i);
+    std::copy(values + begin, values + begin + dim, base.begin() + i * dim);
+    ids[i] = id_array->Value(i);
+  }
+  sink.process(base.data(), ids.data(), nb);
+  return true;
+}
+
+// stream the whole base set of dataset through sink on thread_num threads,
+// VECS base files are read as read_options say
+template <typename Sink>
+void scanBase(const DataSet *dataset, size_t thread_num,
+              const util::ReadOptions &read_options, Sink &sink) {
+  std::unique_ptr<DataSource> datasource;
+  switch (dataset->format_) {
+  case DataSetFormat::FVECS_FORMAT:
+    datasource.reset(new VecsDataSource<float>(
+        dataset, default_gt_batch_size, thread_num,
+        [&](VecsBlock *block) -> bool {
+          return processVecsBlock<float>(sink, block);
+        },
+        read_options));
+    break;
+  case DataSetFormat::BVECS_FORMAT:
+    datasource.reset(new VecsDataSource<uint8_t>(
+        dataset, default_gt_batch_size, thread_num,
+        [&](VecsBlock *block) -> bool {
+          return processVecsBlock<uint8_t>(sink, block);
+        },
+        read_options));
+    break;
+  case DataSetFormat::PARQUET_FORMAT:
+    if (dataset->base_type_ == DataSetBaseType::FLOAT) {
+      datasource.reset(new ParquetDataSource(
+          dataset, default_gt_batch_size, thread_num,
+          [&](std::shared_ptr<arrow::RecordBatch> &batch,
+              const DataSet *ds) -> bool {
+            return processRecordBatch<float>(sink, batch, ds);
+          }));
+    } else {
+      assert(dataset->base_type_ == DataSetBaseType::DOUBLE);
+      datasource.reset(new ParquetDataSource(
+          dataset, default_gt_batch_size, thread_num,
+          [&](std::shared_ptr<arrow::RecordBatch> &batch,
+              const DataSet *ds) -> bool {
+            return processRecordBatch<double>(sink, batch, ds);
+          }));
+    }
+    break;
+  default:
+    SPDLOG_ERROR("Format not supported");
+    std::exit(1);
+  }
+
+  datasource->start();
+  datasource->wait_for_finish();
+}
+
+// only metrics with a float distance kernel can be computed on the client
+void checkMetric(const DataSet *dataset) {
+  switch (dataset->metric_) {
+  case DataSetMetric::L1:
+  case DataSetMetric::L2:
+  case DataSetMetric::IP:
+  case DataSetMetric::COSINE:
+    break;
+  default:
+    SPDLOG_ERROR("computing distances for {} is not supported",
+                 metric2ops(dataset->metric_));
+    std::exit(1);
+  }
+}
+
+} // namespace
+
+// Brute force the top_k nearest neighbors of every query by streaming the
+// base set through the data source readers, their distances are returned in
+// distances if it is given. Only base vectors accepted by filter are
+// candidates if it is not empty.
+std::vector<int64_t>
+computeGroundTruths(const DataSet *dataset, const float *queries, size_t count,
+                    size_t top_k, size_t thread_num,
+                    const util::ReadOptions &read_options,
+                    std::vector<float> *distances,
+                    const std::function<bool(int64_t, const float *)> &filter) {
+  checkMetric(dataset);
+
+  GroundTruthEngine engine(dataset, queries, count, top_k, filter);
+  auto start = std::chrono::high_resolution_clock::now();
+  scanBase(dataset, thread_num, read_options, engine);
+  auto end = std::chrono::high_resolution_clock::now();
+  SPDLOG_INFO("computed ground truth of {} queries over {} base vectors in "
+              "{} ms ({}, {} threads)",
+              count, dataset->total_cnt_,
+              (std::chrono::duration_cast<std::chrono::milliseconds>)(end -
+                                                                      start)
+                  .count(),
+              engine.isa(), thread_num);
+
+  return engine.result(distances);
+}
+
+// Distances between every query and the top_k ground truth neighbors in gts,
+// closest first, computed with the base vectors of the dataset.
+std::vector<float>
+computeGroundTruthDistances(const DataSet *dataset, const float *queries,
+                            const int64_t *gts, size_t count, size_t top_k,
+                            size_t thread_num,
+                            const util::ReadOptions &read_options) {
+  checkMetric(dataset);
+
+  GroundTruthDistances lookup(dataset, queries, gts, count, top_k);
+  auto start = std::chrono::high_resolution_clock::now();
+  scanBase(dataset, thread_num, read_options, lookup);
+  auto end = std::chrono::high_resolution_clock::now();
+  SPDLOG_INFO("computed ground truth distances of {} queries in {} ms ({}, {} "
+              "threads)",
+              count,
+              (std::chrono::duration_cast<std::chrono::milliseconds>)(end -
+                                                                      start)
+                  .count(),
+              lookup.isa(), thread_num);
+
+  return lookup.result();
+}
+
+} // namespace pgvectorbench
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <memory>
 #include <sstream>
@@ -7,7 +9,7 @@
 
 // third party
 #include <arrow/array.h>
-#include <concurrentqueue.h>
+#include <blockingconcurrentqueue.h>
 #include <lightweightsemaphore.h>
 #include <parquet/arrow/reader.h>
 #include <parquet/exception.h>
@@ -15,49 +17,114 @@
 
 #include "dataset/dataset.h"
 #include "dataset/datasource.h"
+#include "utils/attributes.h"
+#include "utils/binary_format.h"
 #include "utils/client_factory.h"
 #include "utils/parser.h"
 #include "utils/util.h"
 
 namespace pgvectorbench {
 
-using moodycamel::ConcurrentQueue;
+using moodycamel::BlockingConcurrentQueue;
 using moodycamel::LightweightSemaphore;
 
 namespace {
 
 const static size_t default_load_batch_size = 100;
 const static ssize_t default_queue_capacity = 64;
+const static size_t default_commit_rows = 100000;
+const static size_t default_commit_bytes = 256 * 1024 * 1024;
+// how long an idle consumer blocks before checking for the end of the stream
+constexpr int64_t consumer_wait_us = 100000;
 constexpr auto max_precision{std::numeric_limits<long double>::digits10 + 1};
 
+// https://www.postgresql.org/docs/current/sql-copy.html#id-1.9.3.55.9.4
+// 11 bytes signature, 32-bit flags field and 32-bit header extension length
+constexpr char copy_binary_header[] = "PGCOPY\n\377\r\n\0"
+                                      "\0\0\0\0"
+                                      "\0\0\0\0";
+constexpr size_t copy_binary_header_size = sizeof(copy_binary_header) - 1;
+// 16-bit field count -1 marks the end of binary COPY data
+constexpr char copy_binary_trailer[] = "\377\377";
+constexpr size_t copy_binary_trailer_size = sizeof(copy_binary_trailer) - 1;
+
+enum class CopyFormat : uint8_t {
+  CSV,
+  BINARY,
+};
+
+// int4 as pg_type knows it, the element type of the tags array
+constexpr int32_t int4_oid = 23;
+// microseconds between the unix and the PostgreSQL epoch
+constexpr int64_t postgres_epoch_offset_us = 946684800LL * 1000000;
+
+// a chunk of COPY data along with the number of rows it holds, an empty
+// chunk marks the end of the stream
+struct CopyContent {
+  std::string data;
+  size_t rows{0};
+  int64_t start_id{0}; // id of the first row, for logging
+};
+
+// id of the first row of a record batch, 0 for an empty one
+int64_t firstId(const std::shared_ptr<arrow::RecordBatch> &batch) {
+  if (batch->num_rows() == 0) {
+    return 0;
+  }
+  return std::static_pointer_cast<arrow::Int64Array>(batch->column(0))
+      ->Value(0);
+}
+
+int64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
 std::string
 generateCopyTableStatement(const DataSet *dataset,
-                           const std::optional<std::string> &table_name) {
+                           const std::optional<std::string> &table_name,
+                           CopyFormat format) {
   std::ostringstream oss;
   oss << "COPY "
       << (table_name.has_value() ? table_name.value() : dataset->name_);
-  oss << " FROM STDIN WITH (FORMAT CSV, DELIMITER '|')";
+  if (format == CopyFormat::BINARY) {
+    oss << " FROM STDIN WITH (FORMAT BINARY)";
+  } else {
+    oss << " FROM STDIN WITH (FORMAT CSV, DELIMITER '|')";
+  }
 
   std::string statement = oss.str();
   SPDLOG_DEBUG("copy table statement: {}", statement);
   return statement;
 }
 
+// append the attribute columns of one CSV row
+void putAttributesCsv(std::ostringstream &oss, const Attributes &attrs,
+                      uint32_t tags_per_row) {
+  oss << '|' << attrs.category << '|'
+      << AttributeGenerator::formatTimestamp(attrs.ts) << "|{";
+  for (uint32_t t = 0; t < tags_per_row; t++) {
+    if (t > 0) {
+      oss << ',';
+    }
+    oss << attrs.tags[t];
+  }
+  oss << '}';
+}
+
 template <typename DataType>
-std::string VecsToCopyContent(const VecsBlock *block) {
+std::string VecsToCopyContent(const VecsBlock *block,
+                              const AttributeGenerator *attrs) {
   uint32_t ds_dim = block->dataset_->dim_;
   std::ostringstream oss;
   char result[16]; // used for converting floating point numbers to decimal
                    // strings
-  bool flag = true;
   size_t rowsize = (sizeof(uint32_t) + ds_dim * sizeof(DataType));
 
+  // every row is newline terminated so that blocks can be concatenated into
+  // one COPY stream
   for (size_t i = 0; i < block->batch_size_; i++) {
-    if (flag) {
-      flag = false;
-    } else {
-      oss << '\n';
-    }
     oss << block->start_id_ + i << " | [";
     uint32_t dim = *(uint32_t *)(block->buffer_ + rowsize * i);
     assert(dim == ds_dim);
@@ -80,6 +147,11 @@ std::string VecsToCopyContent(const VecsBlock *block) {
       }
     }
     oss << "]";
+    if (attrs != nullptr) {
+      putAttributesCsv(oss, attrs->generate(block->start_id_ + i, vecs),
+                       attrs->options().tags_per_row);
+    }
+    oss << "\n";
   }
 
   return oss.str();
@@ -87,13 +159,13 @@ std::string VecsToCopyContent(const VecsBlock *block) {
 
 template <typename DataType>
 std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
-                                     const DataSet *dataset) {
+                                     const DataSet *dataset,
+                                     const AttributeGenerator *attrs) {
   auto id_array = std::static_pointer_cast<arrow::Int64Array>(batch->column(0));
   auto list_array =
       std::static_pointer_cast<arrow::ListArray>(batch->column(1));
 
   std::ostringstream oss;
-  bool flag = true;
   size_t begin = 0;
   if constexpr (std::is_same_v<DataType, float>) {
     auto float_array =
@@ -103,11 +175,6 @@ std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
 
     // strings
     for (size_t i = 0; i < batch->num_rows(); i++) {
-      if (flag) {
-        flag = false;
-      } else {
-        oss << '\n';
-      }
       oss << id_array->Value(i) << " | [";
       size_t end = begin + dataset->dim_;
       for (int j = begin; j < end; j++) {
@@ -118,6 +185,13 @@ std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
         }
       }
       oss << "]";
+      if (attrs != nullptr) {
+        putAttributesCsv(oss,
+                         attrs->generate(id_array->Value(i),
+                                         float_array->raw_values() + begin),
+                         attrs->options().tags_per_row);
+      }
+      oss << "\n";
       begin = end;
     }
   } else {
@@ -126,11 +200,6 @@ std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
     char result[40]; // used for converting double floating point numbers to
                      // decimal strings
     for (size_t i = 0; i < batch->num_rows(); i++) {
-      if (flag) {
-        flag = false;
-      } else {
-        oss << '\n';
-      }
       oss << id_array->Value(i) << " | [";
       size_t end = begin + dataset->dim_;
       for (int j = begin; j < end; j++) {
@@ -141,6 +210,13 @@ std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
         }
       }
       oss << "]";
+      if (attrs != nullptr) {
+        putAttributesCsv(oss,
+                         attrs->generate(id_array->Value(i),
+                                         double_array->raw_values() + begin),
+                         attrs->options().tags_per_row);
+      }
+      oss << "\n";
       begin = end;
     }
   }
@@ -148,6 +224,150 @@ std::string RecordBatchToCopyContent(std::shared_ptr<arrow::RecordBatch> &batch,
   return oss.str();
 }
 
+// binary COPY wants the exact wire size of the id column, which is the first
+// field of every dataset
+size_t idFieldSize(const DataSet *dataset) {
+  assert(!dataset->fields_.empty());
+  const auto &type = dataset->fields_.front().second;
+  return (type == "int8" || type == "bigint") ? sizeof(int64_t)
+                                              : sizeof(int32_t);
+}
+
+// size of a one dimensional int4 array as array_send lays it out: ndim,
+// has null flag, element type, dimension, lower bound and length prefixed
+// elements
+size_t tagsBinarySize(uint32_t tags_per_row) {
+  return sizeof(int32_t) * 5 + tags_per_row * sizeof(int32_t) * 2;
+}
+
+// size of one binary COPY tuple: field count, id and a pgvector value laid out
+// as its send/recv functions expect (int16 dim, int16 unused, float4[dim]),
+// followed by the category, ts and tags attributes if there are any
+size_t binaryTupleSize(size_t id_size, size_t dim,
+                       const AttributeGenerator *attrs) {
+  size_t size = sizeof(int16_t) + sizeof(int32_t) + id_size +
+                sizeof(int32_t) + util::vectorBinarySize(dim);
+  if (attrs != nullptr) {
+    size += sizeof(int32_t) * 2 + sizeof(int32_t) + sizeof(int64_t) +
+            sizeof(int32_t) + tagsBinarySize(attrs->options().tags_per_row);
+  }
+  return size;
+}
+
+char *putBinaryAttributes(char *ptr, const Attributes &attrs,
+                          uint32_t tags_per_row) {
+  ptr = util::putInt32(ptr, sizeof(int32_t));
+  ptr = util::putInt32(ptr, attrs.category);
+  ptr = util::putInt32(ptr, sizeof(int64_t));
+  ptr = util::putInt64(ptr, attrs.ts * 1000000 - postgres_epoch_offset_us);
+  ptr = util::putInt32(ptr, static_cast<int32_t>(tagsBinarySize(tags_per_row)));
+  ptr = util::putInt32(ptr, 1); // ndim
+  ptr = util::putInt32(ptr, 0); // no nulls
+  ptr = util::putInt32(ptr, int4_oid);
+  ptr = util::putInt32(ptr, static_cast<int32_t>(tags_per_row));
+  ptr = util::putInt32(ptr, 1); // lower bound
+  for (uint32_t t = 0; t < tags_per_row; t++) {
+    ptr = util::putInt32(ptr, sizeof(int32_t));
+    ptr = util::putInt32(ptr, attrs.tags[t]);
+  }
+  return ptr;
+}
+
+template <typename DataType>
+char *putBinaryTuple(char *ptr, int64_t id, size_t id_size,
+                     const DataType *vecs, size_t dim,
+                     const AttributeGenerator *attrs) {
+  // id and vector, plus the attributes
+  ptr = util::putInt16(ptr, attrs != nullptr ? 5 : 2);
+  ptr = util::putInt32(ptr, static_cast<int32_t>(id_size));
+  if (id_size == sizeof(int64_t)) {
+    ptr = util::putInt64(ptr, id);
+  } else {
+    ptr = util::putInt32(ptr, static_cast<int32_t>(id));
+  }
+  ptr =
+      util::putInt32(ptr, static_cast<int32_t>(util::vectorBinarySize(dim)));
+  ptr = util::putVector(ptr, vecs, dim);
+  if (attrs != nullptr) {
+    ptr = putBinaryAttributes(ptr, attrs->generate(id, vecs),
+                              attrs->options().tags_per_row);
+  }
+  return ptr;
+}
+
+// Encode a VECS block as binary COPY tuples, the vectors are byte swapped
+// straight out of the read buffer. A framed payload carries its own header
+// and trailer, an unframed one is meant for a long-lived COPY stream.
+template <typename DataType>
+std::string VecsToCopyBinary(const VecsBlock *block, size_t id_size,
+                             bool framed, const AttributeGenerator *attrs) {
+  uint32_t ds_dim = block->dataset_->dim_;
+  size_t rowsize = (sizeof(uint32_t) + ds_dim * sizeof(DataType));
+  size_t tuplesize = binaryTupleSize(id_size, ds_dim, attrs);
+
+  size_t framesize =
+      framed ? copy_binary_header_size + copy_binary_trailer_size : 0;
+  std::string content(framesize + tuplesize * block->batch_size_, '\0');
+  char *ptr = content.data();
+  if (framed) {
+    memcpy(ptr, copy_binary_header, copy_binary_header_size);
+    ptr += copy_binary_header_size;
+  }
+
+  for (size_t i = 0; i < block->batch_size_; i++) {
+    uint32_t dim = *(uint32_t *)(block->buffer_ + rowsize * i);
+    assert(dim == ds_dim);
+    const DataType *vecs =
+        (const DataType *)(block->buffer_ + rowsize * i + sizeof(uint32_t));
+    ptr = putBinaryTuple<DataType>(ptr, block->start_id_ + i, id_size, vecs,
+                                   dim, attrs);
+  }
+
+  if (framed) {
+    memcpy(ptr, copy_binary_trailer, copy_binary_trailer_size);
+  }
+  return content;
+}
+
+template <typename DataType>
+std::string
+RecordBatchToCopyBinary(std::shared_ptr<arrow::RecordBatch> &batch,
+                        const DataSet *dataset, size_t id_size, bool framed,
+                        const AttributeGenerator *attrs) {
+  auto id_array = std::static_pointer_cast<arrow::Int64Array>(batch->column(0));
+  auto list_array =
+      std::static_pointer_cast<arrow::ListArray>(batch->column(1));
+  const DataType *values;
+  if constexpr (std::is_same_v<DataType, float>) {
+    values = std::static_pointer_cast<arrow::FloatArray>(list_array->values())
+                 ->raw_values();
+  } else {
+    values = std::static_pointer_cast<arrow::DoubleArray>(list_array->values())
+                 ->raw_values();
+  }
+
+  size_t tuplesize = binaryTupleSize(id_size, dataset->dim_, attrs);
+  size_t framesize =
+      framed ? copy_binary_header_size + copy_binary_trailer_size : 0;
+  std::string content(framesize + tuplesize * batch->num_rows(), '\0');
+  char *ptr = content.data();
+  if (framed) {
+    memcpy(ptr, copy_binary_header, copy_binary_header_size);
+    ptr += copy_binary_header_size;
+  }
+
+  for (int64_t i = 0; i < batch->num_rows(); i++) {
+    ptr = putBinaryTuple<DataType>(ptr, id_array->Value(i), id_size,
+                                   values + list_array->value_offset(i),
+                                   dataset->dim_, attrs);
+  }
+
+  if (framed) {
+    memcpy(ptr, copy_binary_trailer, copy_binary_trailer_size);
+  }
+  return content;
+}
+
 } // namespace
 
 void load(const DataSet *dataset, const ClientFactory *cf,
@@ -155,8 +375,9 @@ void load(const DataSet *dataset, const ClientFactory *cf,
   assert(dataset != nullptr);
   assert(cf != nullptr);
   size_t batch_size = default_load_batch_size;
+  // parquet workers decode and convert, vecs workers also wait on reads
   size_t thread_num = dataset->format_ == DataSetFormat::PARQUET_FORMAT
-                          ? dataset->base_files_.size()
+                          ? std::thread::hardware_concurrency()
                           : std::thread::hardware_concurrency() * 2;
   size_t client_num =
       std::thread::hardware_concurrency(); // number of pg client
@@ -170,24 +391,17 @@ void load(const DataSet *dataset, const ClientFactory *cf,
   // parse thread num used for datasource
   auto tn = Util::getValueFromMap(load_opt_map, "thread_num");
   if (tn.has_value()) {
-    auto parsed_thread_num = std::stoul(tn.value());
-    if (dataset->format_ == DataSetFormat::PARQUET_FORMAT) {
-      if (parsed_thread_num > thread_num) {
-        SPDLOG_WARN("The specified thread number {} exceeds the optimal number "
-                    "for processing {} base {}, fallback to using {}",
-                    parsed_thread_num, dataset->base_files_.size(),
-                    dataset->base_files_.size() > 1 ? "files" : "file",
-                    thread_num);
-        std::exit(1);
-      } else {
-        thread_num = parsed_thread_num;
-      }
-    } else {
-      thread_num = parsed_thread_num;
-    }
+    thread_num = std::stoul(tn.value());
   }
   assert(thread_num > 0);
 
+  // parse pin_threads, each datasource worker is bound to one CPU
+  bool pin_threads = false;
+  auto pt = Util::getValueFromMap(load_opt_map, "pin_threads");
+  if (pt.has_value()) {
+    pin_threads = Util::isYes(pt.value());
+  }
+
   // parse client num
   auto cn = Util::getValueFromMap(load_opt_map, "client_num");
   if (cn.has_value()) {
@@ -197,47 +411,164 @@ void load(const DataSet *dataset, const ClientFactory *cf,
   // parse queue capacity
   auto qc = Util::getValueFromMap(load_opt_map, "queue_capacity");
   if (qc.has_value()) {
-    queue_capacity = std::stol(cn.value());
+    queue_capacity = std::stol(qc.value());
   }
 
+  // parse copy format, binary skips float formatting on the client and
+  // parsing on the server
+  CopyFormat copy_format = CopyFormat::CSV;
+  auto cfmt = Util::getValueFromMap(load_opt_map, "format");
+  if (cfmt.has_value()) {
+    std::string lowercase = cfmt.value();
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (lowercase == "binary") {
+      copy_format = CopyFormat::BINARY;
+    } else if (lowercase != "csv") {
+      SPDLOG_ERROR("Illegal copy format: {}", cfmt.value());
+      std::exit(1);
+    }
+  }
+  const bool binary = copy_format == CopyFormat::BINARY;
+  const size_t id_size = idFieldSize(dataset);
+
+  // parse copy mode, batch issues one COPY per queued block while stream
+  // keeps a COPY open on each client and only commits every commit_rows rows
+  // or commit_bytes bytes, whichever comes first
+  bool streaming = false;
+  auto cm = Util::getValueFromMap(load_opt_map, "copy_mode");
+  if (cm.has_value()) {
+    std::string lowercase = cm.value();
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (lowercase == "stream") {
+      streaming = true;
+    } else if (lowercase != "batch") {
+      SPDLOG_ERROR("Illegal copy mode: {}", cm.value());
+      std::exit(1);
+    }
+  }
+
+  size_t commit_rows = default_commit_rows;
+  auto cr = Util::getValueFromMap(load_opt_map, "commit_rows");
+  if (cr.has_value()) {
+    commit_rows = std::stoul(cr.value());
+  }
+
+  size_t commit_bytes = default_commit_bytes;
+  auto cb = Util::getValueFromMap(load_opt_map, "commit_bytes");
+  if (cb.has_value()) {
+    commit_bytes = std::stoul(cb.value());
+  }
+
+  // parse percentages used for reporting commit latency
+  std::vector<std::pair<std::string, double>> percentages;
+  auto pct = Util::getValueFromMap(load_opt_map, "percentages");
+  if (pct.has_value()) {
+    CSVParser::parseLine(*pct, [&](std::string &token) {
+      double val = std::stod(token);
+      percentages.emplace_back(token, val);
+    });
+  }
+
+  // parse how VECS base files are read, pread copies each block into a per
+  // thread buffer, uring does the same with the reads queued to io_uring and
+  // mmap hands out pointers into the mapped file
+  util::ReadOptions read_options = util::parseReadOptions(load_opt_map);
+
+  // parse attributes, the attribute columns created by setup are filled from
+  // a seeded distribution
+  std::unique_ptr<AttributeGenerator> attribute_generator;
+  auto attribute_options = parseAttributeOptions(load_opt_map);
+  if (attribute_options.has_value()) {
+    attribute_generator = std::make_unique<AttributeGenerator>(
+        attribute_options.value(), dataset->dim_);
+  }
+  const AttributeGenerator *attrs = attribute_generator.get();
+
   auto table_name = Util::getValueFromMap(load_opt_map, "table_name");
-  auto copy_table_statement = generateCopyTableStatement(dataset, table_name);
+  auto copy_table_statement =
+      generateCopyTableStatement(dataset, table_name, copy_format);
+
+  // binary payloads only carry the header and trailer when each of them is
+  // a COPY on its own
+  const bool framed = !streaming;
 
-  ConcurrentQueue<std::string> sql_queue;   // lock free MPMC
+  BlockingConcurrentQueue<CopyContent> sql_queue; // lock free MPMC
   LightweightSemaphore sem(queue_capacity); // use this to limit sql_queue size
 
-  std::atomic<bool> finished{false};
+  // producers wait on sem while the queue is full and consumers wait on the
+  // queue while it is empty, together they tell whether the client or the
+  // server is the bottleneck
+  std::atomic<int64_t> producer_stall_ns{0};
+  std::atomic<int64_t> consumer_idle_ns{0};
+  std::atomic<size_t> queued{0}; // chunks enqueued and not yet dequeued
+  std::atomic<size_t> occupancy_sum{0};
+  std::atomic<size_t> occupancy_max{0};
+  std::atomic<size_t> occupancy_samples{0};
+
+  // producers block here inside the convert callback of the data source,
+  // which is told so that it does not count the wait as converting
   std::unique_ptr<DataSource> datasource;
+  auto acquire_slot = [&]() {
+    if (sem.tryWait()) {
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    sem.wait();
+    int64_t stall_ns = elapsedNs(start);
+    producer_stall_ns.fetch_add(stall_ns);
+    datasource->add_handoff_ns(stall_ns);
+  };
+  auto enqueue = [&](CopyContent &&content) -> bool {
+    queued.fetch_add(1);
+    if (sql_queue.enqueue(std::move(content))) {
+      return true;
+    }
+    queued.fetch_sub(1);
+    return false;
+  };
+
+  std::atomic<bool> finished{false};
   switch (dataset->format_) {
   case DataSetFormat::FVECS_FORMAT:
     datasource.reset(new VecsDataSource<float>(
         dataset, batch_size, thread_num, [&](VecsBlock *block) -> bool {
-          sem.wait();
-          auto str = VecsToCopyContent<float>(block);
-          if (sql_queue.enqueue(str)) {
-            SPDLOG_DEBUG("enqueue start_id: {} content: {}", block->start_id_,
-                         str);
+          acquire_slot();
+          CopyContent content{
+              binary ? VecsToCopyBinary<float>(block, id_size, framed, attrs)
+                     : VecsToCopyContent<float>(block, attrs),
+              block->batch_size_, static_cast<int64_t>(block->start_id_)};
+          SPDLOG_DEBUG("enqueue {} rows, {} bytes from id {}", content.rows,
+                       content.data.size(), content.start_id);
+          if (enqueue(std::move(content))) {
             return true;
           }
           sem.signal();
           SPDLOG_ERROR("enqueue failed");
           return false;
-        }));
+        },
+        read_options, pin_threads));
     break;
   case DataSetFormat::BVECS_FORMAT:
     datasource.reset(new VecsDataSource<uint8_t>(
         dataset, batch_size, thread_num, [&](VecsBlock *block) -> bool {
-          sem.wait();
-          auto str = VecsToCopyContent<uint8_t>(block);
-          if (sql_queue.enqueue(str)) {
-            SPDLOG_DEBUG("enqueue start_id: {} content: {}", block->start_id_,
-                         str);
+          acquire_slot();
+          CopyContent content{
+              binary
+                  ? VecsToCopyBinary<uint8_t>(block, id_size, framed, attrs)
+                  : VecsToCopyContent<uint8_t>(block, attrs),
+              block->batch_size_, static_cast<int64_t>(block->start_id_)};
+          SPDLOG_DEBUG("enqueue {} rows, {} bytes from id {}", content.rows,
+                       content.data.size(), content.start_id);
+          if (enqueue(std::move(content))) {
             return true;
           }
           sem.signal();
           SPDLOG_ERROR("enqueue failed");
           return true;
-        }));
+        },
+        read_options, pin_threads));
     break;
   case DataSetFormat::PARQUET_FORMAT:
     if (dataset->base_type_ == DataSetBaseType::FLOAT) {
@@ -245,32 +576,44 @@ void load(const DataSet *dataset, const ClientFactory *cf,
           dataset, batch_size, thread_num,
           [&](std::shared_ptr<arrow::RecordBatch> &batch,
               const DataSet *ds) -> bool {
-            sem.wait();
-            auto str = RecordBatchToCopyContent<float>(batch, ds);
-            if (sql_queue.enqueue(str)) {
-              SPDLOG_DEBUG("enqueue content: {}", str);
+            acquire_slot();
+            CopyContent content{
+                binary ? RecordBatchToCopyBinary<float>(batch, ds, id_size,
+                                                        framed, attrs)
+                       : RecordBatchToCopyContent<float>(batch, ds, attrs),
+                static_cast<size_t>(batch->num_rows()), firstId(batch)};
+            SPDLOG_DEBUG("enqueue {} rows, {} bytes from id {}", content.rows,
+                         content.data.size(), content.start_id);
+            if (enqueue(std::move(content))) {
               return true;
             }
             sem.signal();
             SPDLOG_ERROR("enqueue failed");
             return true;
-          }));
+          },
+          pin_threads));
     } else {
       assert(dataset->base_type_ == DataSetBaseType::DOUBLE);
       datasource.reset(new ParquetDataSource(
           dataset, batch_size, thread_num,
           [&](std::shared_ptr<arrow::RecordBatch> &batch,
               const DataSet *ds) -> bool {
-            sem.wait();
-            auto str = RecordBatchToCopyContent<double>(batch, ds);
-            if (sql_queue.enqueue(str)) {
-              SPDLOG_DEBUG("enqueue content: {}", str);
+            acquire_slot();
+            CopyContent content{
+                binary ? RecordBatchToCopyBinary<double>(batch, ds, id_size,
+                                                         framed, attrs)
+                       : RecordBatchToCopyContent<double>(batch, ds, attrs),
+                static_cast<size_t>(batch->num_rows()), firstId(batch)};
+            SPDLOG_DEBUG("enqueue {} rows, {} bytes from id {}", content.rows,
+                         content.data.size(), content.start_id);
+            if (enqueue(std::move(content))) {
               return true;
             }
             sem.signal();
             SPDLOG_ERROR("enqueue failed");
             return true;
-          }));
+          },
+          pin_threads));
     }
 
     break;
@@ -279,25 +622,125 @@ void load(const DataSet *dataset, const ClientFactory *cf,
     std::exit(1);
   }
 
+  auto load_start = std::chrono::steady_clock::now();
   datasource->start();
 
+  // rows of failed COPYs, the load fails if any were lost
+  std::atomic<size_t> lost_rows{0};
+  // per client commit latencies, only collected in stream mode
+  std::vector<std::vector<uint32_t>> commit_latencies(client_num);
+
   std::vector<std::thread> threads;
   for (size_t i = 0; i < client_num; i++) {
-    threads.emplace_back([&]() {
+    threads.emplace_back([&, i]() {
       auto client = cf->createClient();
-      std::string ele;
-      while (!finished.load() || sem.availableApprox() != queue_capacity) {
-        if (sql_queue.try_dequeue(ele)) {
-          auto ret = client->copy(copy_table_statement.c_str(), ele.c_str(),
-                                  ele.size(), [&](PGresult *res) -> bool {
+      CopyContent ele;
+
+      // state of the long-lived COPY stream
+      bool in_copy = false;
+      size_t pending_rows = 0;
+      size_t pending_bytes = 0;
+
+      auto open_stream = [&]() -> bool {
+        if (!client->beginCopy(copy_table_statement.c_str())) {
+          return false;
+        }
+        if (binary &&
+            !client->putCopyData(copy_binary_header, copy_binary_header_size)) {
+          client->abortCopy("put COPY header failed");
+          return false;
+        }
+        return true;
+      };
+
+      auto commit_stream = [&]() {
+        auto start = std::chrono::high_resolution_clock::now();
+        bool ret = !binary || client->putCopyData(copy_binary_trailer,
+                                                  copy_binary_trailer_size);
+        ret = client->endCopy([&](PGresult *res) -> bool {
+          // no need to handle result
+          return true;
+        }) && ret;
+        auto end = std::chrono::high_resolution_clock::now();
+        uint32_t microseconds =
+            (std::chrono::duration_cast<std::chrono::microseconds>)(end - start)
+                .count();
+        if (ret) {
+          commit_latencies[i].push_back(microseconds);
+          SPDLOG_DEBUG("committed {} rows, {} bytes in {}us", pending_rows,
+                       pending_bytes, microseconds);
+        } else {
+          SPDLOG_ERROR("failed to commit {} rows of COPY stream",
+                       pending_rows);
+          lost_rows.fetch_add(pending_rows);
+        }
+        in_copy = false;
+        pending_rows = 0;
+        pending_bytes = 0;
+      };
+
+      for (;;) {
+        auto wait_start = std::chrono::steady_clock::now();
+        bool dequeued = sql_queue.wait_dequeue_timed(ele, consumer_wait_us);
+        consumer_idle_ns.fetch_add(elapsedNs(wait_start));
+        if (!dequeued || ele.data.empty()) {
+          // end of the stream or timed out, leave once every chunk is taken
+          if (finished.load() && queued.load() == 0) {
+            break;
+          }
+          continue;
+        }
+
+        // chunks waiting in the queue, this one included
+        size_t occupancy = queued.fetch_sub(1);
+        occupancy_sum.fetch_add(occupancy);
+        occupancy_samples.fetch_add(1);
+        size_t max = occupancy_max.load();
+        while (occupancy > max &&
+               !occupancy_max.compare_exchange_weak(max, occupancy)) {
+        }
+        if (streaming) {
+          if (!in_copy) {
+            in_copy = open_stream();
+          }
+          if (in_copy &&
+              client->putCopyData(ele.data.c_str(), ele.data.size())) {
+            pending_rows += ele.rows;
+            pending_bytes += ele.data.size();
+            if ((commit_rows > 0 && pending_rows >= commit_rows) ||
+                (commit_bytes > 0 && pending_bytes >= commit_bytes)) {
+              commit_stream();
+            }
+          } else {
+            // the rows sent since the last commit are rolled back with it
+            if (in_copy) {
+              client->abortCopy("put data into COPY stream failed");
+            }
+            SPDLOG_ERROR("failed to stream {} rows into COPY",
+                         pending_rows + ele.rows);
+            lost_rows.fetch_add(pending_rows + ele.rows);
+            in_copy = false;
+            pending_rows = 0;
+            pending_bytes = 0;
+          }
+        } else {
+          auto ret = client->copy(copy_table_statement.c_str(),
+                                  ele.data.c_str(), ele.data.size(),
+                                  [&](PGresult *res) -> bool {
                                     // no need to handle result
                                     return true;
                                   });
           if (!ret) {
-            SPDLOG_ERROR("failed to handle copy command: {}", ele);
+            SPDLOG_ERROR("failed to copy {} rows, {} bytes from id {}",
+                         ele.rows, ele.data.size(), ele.start_id);
+            lost_rows.fetch_add(ele.rows);
           }
-          sem.signal();
         }
+        sem.signal();
+      }
+
+      if (in_copy) {
+        commit_stream();
       }
     });
   }
@@ -306,6 +749,10 @@ void load(const DataSet *dataset, const ClientFactory *cf,
 
   SPDLOG_DEBUG("datasouce has finished all reading");
   finished.store(true);
+  // wake every consumer up instead of letting them time out
+  for (size_t i = 0; i < client_num; i++) {
+    sql_queue.enqueue(CopyContent{});
+  }
 
   for (size_t i = 0; i < client_num; i++) {
     threads.at(i).join();
@@ -313,6 +760,42 @@ void load(const DataSet *dataset, const ClientFactory *cf,
 
   SPDLOG_DEBUG("LightweightSemaphore availableApprox: {}",
                sem.availableApprox());
+
+  // a queue that is mostly full with stalled producers means the server
+  // does not keep up, a mostly empty one with idle consumers means the client
+  // does not
+  double wall_ns = elapsedNs(load_start);
+  double stall = producer_stall_ns.load() / (wall_ns * thread_num);
+  double idle = consumer_idle_ns.load() / (wall_ns * client_num);
+  size_t samples = occupancy_samples.load();
+  SPDLOG_INFO("queue occupancy: mean {:.1f}, max {} of {}",
+              samples > 0 ? static_cast<double>(occupancy_sum.load()) / samples
+                          : 0.0,
+              occupancy_max.load(), queue_capacity);
+  SPDLOG_INFO("producer stall: {:.2f}s ({:.1f}% of {} producers), consumer "
+              "idle: {:.2f}s ({:.1f}% of {} consumers)",
+              producer_stall_ns.load() / 1e9, stall * 100, thread_num,
+              consumer_idle_ns.load() / 1e9, idle * 100, client_num);
+  SPDLOG_INFO("load looks {}-bound", stall > idle ? "server" : "client");
+
+  if (streaming) {
+    Percentile<uint32_t> p_commits(true);
+    size_t commits = 0;
+    for (const auto &latencies : commit_latencies) {
+      p_commits.add(latencies.data(), latencies.size());
+      commits += latencies.size();
+    }
+    SPDLOG_INFO("commits: {}", commits);
+    if (commits > 0) {
+      SPDLOG_INFO("commit latency(us): {}",
+                  percentile2str(p_commits, percentages));
+    }
+  }
+
+  if (lost_rows.load() > 0) {
+    SPDLOG_ERROR("{} rows were not loaded", lost_rows.load());
+    std::exit(1);
+  }
 }
 
 } // namespace pgvectorbench
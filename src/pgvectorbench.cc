@@ -7,7 +7,9 @@
 #include "dataset/dataset.h"
 #include "utils/client_factory.h"
 #include "utils/parser.h"
+#include "utils/server_stats.h"
 #include "utils/util.h"
+#include "utils/wait_sampler.h"
 
 #define PGVECTORBENCH_VERSION "0.1.0"
 
@@ -28,6 +30,9 @@ create_index(const DataSet *dataset, const ClientFactory *cf,
 extern void
 query(const DataSet *dataset, const ClientFactory *cf,
       const std::unordered_map<std::string, std::string> &query_opt_map);
+extern std::string
+rewrite(const DataSet *dataset,
+        const std::unordered_map<std::string, std::string> &rewrite_opt_map);
 extern void
 teardown(const DataSet *dataset, const ClientFactory *cf,
          const std::unordered_map<std::string, std::string> &teardown_opt_map);
@@ -72,6 +77,11 @@ int main(int argc, char **argv) {
   // log file name & log level
   program.add_argument("-l", "--log").help("send log to file");
 
+  // rewrite parquet base files with smaller row groups
+  program.add_argument("--rewrite")
+      .default_value("")
+      .help("k/v pairs seperated by semicolon for rewriting the dataset");
+
   // setup benmarking table and may be some gucs
   program.add_argument("--setup").default_value("").help(
       "k/v pairs seperated by semicolon for setup options");
@@ -135,9 +145,6 @@ int main(int argc, char **argv) {
   }
 
   auto cf = cf_builder.build();
-  if (!cf->pingServer()) {
-    std::exit(1);
-  }
 
   // get DataSet
   std::string dataset = program.get<std::string>("--dataset");
@@ -160,6 +167,37 @@ int main(int argc, char **argv) {
   }
   SPDLOG_INFO("dataset: \n{}", *ds);
 
+  // later phases read the rewritten dataset
+  if (program.is_used("--rewrite")) {
+    auto rewrite_opt = program.get<std::string>("--rewrite");
+    std::unordered_map<std::string, std::string> rewrite_opt_map;
+    pgvectorbench::CSVParser::parseLine(
+        rewrite_opt,
+        [&](std::string &token) {
+          auto pos = token.find('=');
+          if (pos != std::string::npos) {
+            std::string key = token.substr(0, pos);
+            std::string value = token.substr(pos + 1);
+            rewrite_opt_map.emplace(std::move(key), std::move(value));
+          }
+        },
+        ';');
+    SPDLOG_INFO("start rewriting the dataset");
+    ds->set_location(pgvectorbench::rewrite(ds, rewrite_opt_map));
+    SPDLOG_INFO("end of rewriting");
+
+    // rewriting alone needs no server
+    if (!program.is_used("--setup") && !program.is_used("--load") &&
+        !program.is_used("--index") && !program.is_used("--query") &&
+        !program.is_used("--teardown")) {
+      return 0;
+    }
+  }
+
+  if (!cf->pingServer()) {
+    std::exit(1);
+  }
+
   bool index_created = false;
   if (program.is_used("--setup")) {
     auto setup_opt = program.get<std::string>("--setup");
@@ -179,8 +217,22 @@ int main(int argc, char **argv) {
       // index created in setup phase
       index_created = true;
     }
+    auto server_stats = pgvectorbench::util::ServerStats::create(
+        cf.get(), setup_opt_map, ds->name_);
+    auto waits =
+        pgvectorbench::WaitEventSampler::create(cf.get(), setup_opt_map);
     SPDLOG_INFO("start setting up the benchmarking table");
+    if (waits != nullptr) {
+      waits->start();
+    }
     pgvectorbench::setup(ds, cf.get(), setup_opt_map);
+    if (waits != nullptr) {
+      waits->stop();
+      waits->report("setup");
+    }
+    if (server_stats != nullptr) {
+      server_stats->report("setup");
+    }
     SPDLOG_INFO("end of setting up");
   }
 
@@ -198,8 +250,22 @@ int main(int argc, char **argv) {
           }
         },
         ';');
+    auto server_stats = pgvectorbench::util::ServerStats::create(
+        cf.get(), load_opt_map, ds->name_);
+    auto waits =
+        pgvectorbench::WaitEventSampler::create(cf.get(), load_opt_map);
     SPDLOG_INFO("start loading");
+    if (waits != nullptr) {
+      waits->start();
+    }
     pgvectorbench::load(ds, cf.get(), load_opt_map);
+    if (waits != nullptr) {
+      waits->stop();
+      waits->report("load");
+    }
+    if (server_stats != nullptr) {
+      server_stats->report("load");
+    }
     SPDLOG_INFO("end of loading");
   }
 
@@ -219,8 +285,22 @@ int main(int argc, char **argv) {
         },
         ';');
 
+    auto server_stats = pgvectorbench::util::ServerStats::create(
+        cf.get(), index_opt_map, ds->name_);
+    auto waits =
+        pgvectorbench::WaitEventSampler::create(cf.get(), index_opt_map);
     SPDLOG_INFO("start creating index");
+    if (waits != nullptr) {
+      waits->start();
+    }
     pgvectorbench::create_index(ds, cf.get(), index_opt_map);
+    if (waits != nullptr) {
+      waits->stop();
+      waits->report("create_index");
+    }
+    if (server_stats != nullptr) {
+      server_stats->report("create_index");
+    }
     SPDLOG_INFO("end of creating index");
   }
 
@@ -238,8 +318,13 @@ int main(int argc, char **argv) {
           }
         },
         ';');
+    auto server_stats = pgvectorbench::util::ServerStats::create(
+        cf.get(), query_opt_map, ds->name_);
     SPDLOG_INFO("start querying");
     pgvectorbench::query(ds, cf.get(), query_opt_map);
+    if (server_stats != nullptr) {
+      server_stats->report("query");
+    }
     SPDLOG_INFO("end of queryring");
   }
 
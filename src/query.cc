@@ -1,6 +1,17 @@
+#include <algorithm>
 #include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <thread>
 #include <tuple>
@@ -13,20 +24,47 @@
 #include <ryu/ryu.h>
 
 #include "dataset/dataset.h"
+#include "utils/attributes.h"
+#include "utils/binary_format.h"
 #include "utils/client_factory.h"
 #include "utils/file_reader.h"
+#include "utils/histogram.h"
+#include "utils/interval_reporter.h"
 #include "utils/parser.h"
+#include "utils/query_cache.h"
+#include "utils/thread_pool.h"
 #include "utils/util.h"
 
 namespace pgvectorbench {
 
+extern std::vector<int64_t>
+computeGroundTruths(const DataSet *dataset, const float *queries, size_t count,
+                    size_t top_k, size_t thread_num,
+                    const util::ReadOptions &read_options,
+                    std::vector<float> *distances = nullptr,
+                    const std::function<bool(int64_t, const float *)> &filter =
+                        {});
+extern std::vector<float>
+computeGroundTruthDistances(const DataSet *dataset, const float *queries,
+                            const int64_t *gts, size_t count, size_t top_k,
+                            size_t thread_num,
+                            const util::ReadOptions &read_options);
+
 namespace {
 
+constexpr char prepared_stmt_name[] = "pgvectorbench_knn";
+constexpr int default_histogram_precision = 3;
+constexpr uint64_t default_seed = 42;
+// latencies above one hour are clamped
+constexpr uint64_t max_trackable_latency_ns = 3600ULL * 1000 * 1000 * 1000;
+// returned neighbors this close to the kth true distance count as hits,
+// relative to the distance itself once it is above one
+constexpr float distance_tolerance = 1e-3f;
+
+// Read all query vectors of a VECS dataset, they are converted to float and
+// laid out back to back, dim floats per query.
 template <typename DataType>
-std::vector<std::string>
-prepareVecsQueries(const DataSet *dataset,
-                   const std::optional<std::string> &table_name,
-                   size_t top_k2) {
+std::vector<float> prepareVecsQueries(const DataSet *dataset) {
   // test query file path
   auto file_path = dataset->location_ + dataset->query_file_.first;
   std::unique_ptr<util::FileReader> reader =
@@ -37,57 +75,28 @@ prepareVecsQueries(const DataSet *dataset,
   const size_t rowcnt = dataset->query_file_.second;
   assert(filesize == rowsize * rowcnt);
 
-  std::vector<std::string> queries;
-  queries.reserve(rowcnt);
+  std::vector<float> queries(rowcnt * dataset->dim_);
 
-  std::string buffer_(rowsize, ' ');
-  char *buffer = buffer_.data();
-  char result[16]; // used for converting floating point numbers to decimal
-                   // strings
-
-  std::ostringstream oss;
-  oss << "SELECT id FROM "
-      << (table_name.has_value() ? table_name.value() : dataset->name_);
-  oss << " ORDER BY " << dataset->vector_field_ << " "
-      << metric2operator(dataset->metric_) << " ";
-
-  std::string sql_prefix = oss.str();
+  // query files are small, read them in one go
+  std::string buffer_(filesize, ' ');
+  reader->read(buffer_.data(), filesize, 0);
 
   for (size_t i = 0; i < rowcnt; i++) {
-    reader->read(buffer, rowsize, rowsize * i);
+    const char *buffer = buffer_.data() + rowsize * i;
     uint32_t dim = *((uint32_t *)buffer);
-    assert(dim = dataset->dim_);
+    assert(dim == dataset->dim_);
 
-    oss << "'[";
     DataType *vecs = (DataType *)(buffer + sizeof(uint32_t));
-    if constexpr (std::is_same_v<DataType, float>) {
-      for (size_t j = 0; j < dim; j++) {
-        f2s_buffered(vecs[j], result);
-        oss << result;
-        if (j != dim - 1) {
-          oss << ',';
-        }
-      }
-    } else {
-      for (size_t j = 0; j < dim; j++) {
-        oss << vecs[j];
-        if (j != dim - 1) {
-          oss << ',';
-        }
-      }
-    }
-    oss << "]' LIMIT " << top_k2 << ";";
-
-    queries.push_back(oss.str());
-    oss.str("");
-    oss << sql_prefix;
+    std::copy(vecs, vecs + dim, queries.begin() + i * dataset->dim_);
   }
 
   return queries;
 }
 
-std::vector<std::vector<int64_t>> prepareVecsGroudTruths(const DataSet *dataset,
-                                                         size_t top_k1) {
+// Read the ground truth of a VECS dataset, top_k1 ids per query sorted
+// ascending and laid out back to back.
+std::vector<int64_t> prepareVecsGroudTruths(const DataSet *dataset,
+                                            size_t top_k1) {
   assert(top_k1 <= dataset->gt_topk_);
   // ground truth file path
   auto file_path = dataset->location_ + dataset->gt_file_.first;
@@ -98,31 +107,28 @@ std::vector<std::vector<int64_t>> prepareVecsGroudTruths(const DataSet *dataset,
   const size_t rowsize = sizeof(uint32_t) + sizeof(int) * dataset->gt_topk_;
   const size_t rowcnt = dataset->gt_file_.second;
   assert(filesize == rowsize * rowcnt);
-  std::vector<std::vector<int64_t>> gts(rowcnt, std::vector<int64_t>(top_k1));
+  std::vector<int64_t> gts(rowcnt * top_k1);
 
-  std::string buffer_(rowsize, ' ');
-  char *buffer = buffer_.data();
+  std::string buffer_(filesize, ' ');
+  reader->read(buffer_.data(), filesize, 0);
 
   for (size_t i = 0; i < rowcnt; i++) {
-    reader->read(buffer, rowsize, rowsize * i);
+    const char *buffer = buffer_.data() + rowsize * i;
     uint32_t dim = *((uint32_t *)buffer);
-    assert(dim = dataset->dim_);
-    assert(dim > top_k1);
+    assert(dim == dataset->gt_topk_);
+    assert(dim >= top_k1);
     int *vecs = (int *)(buffer + sizeof(uint32_t));
-    for (int j = 0; j < top_k1; j++) {
-      gts[i][j] = vecs[j];
-    }
-    std::sort(gts[i].begin(), gts[i].end());
+    int64_t *gt = gts.data() + i * top_k1;
+    std::copy(vecs, vecs + top_k1, gt);
+    std::sort(gt, gt + top_k1);
   }
 
   return gts;
 }
 
+// Read all query vectors of a Parquet dataset, see prepareVecsQueries
 template <typename DataType>
-std::vector<std::string>
-prepareParquetQueries(const DataSet *dataset,
-                      const std::optional<std::string> &table_name,
-                      size_t top_k2) {
+std::vector<float> prepareParquetQueries(const DataSet *dataset) {
   // test query file path
   auto file_path = dataset->location_ + dataset->query_file_.first;
   arrow::MemoryPool *pool = arrow::default_memory_pool();
@@ -153,13 +159,50 @@ prepareParquetQueries(const DataSet *dataset,
     std::exit(1);
   }
 
-  std::vector<std::string> queries;
-  queries.reserve(dataset->query_file_.second);
-  char result[40]; // used for converting floating / double floating point
-                   // numbers to decimal strings
+  std::vector<float> queries;
+  queries.reserve(dataset->query_file_.second * dataset->dim_);
 
+  std::shared_ptr<arrow::RecordBatch> recordBatch;
+  do {
+    status = rb_reader->ReadNext(&recordBatch);
+    if (!status.ok()) {
+      SPDLOG_ERROR("read next batch failed: {}", status.ToString());
+      std::exit(1);
+    }
+    if (recordBatch) {
+      auto list_array =
+          std::static_pointer_cast<arrow::ListArray>(recordBatch->column(1));
+      for (int64_t i = 0; i < recordBatch->num_rows(); i++) {
+        size_t begin = list_array->value_offset(i);
+        if constexpr (std::is_same_v<DataType, float>) {
+          auto values =
+              std::static_pointer_cast<arrow::FloatArray>(list_array->values())
+                  ->raw_values();
+          queries.insert(queries.end(), values + begin,
+                         values + begin + dataset->dim_);
+        } else {
+          auto values =
+              std::static_pointer_cast<arrow::DoubleArray>(list_array->values())
+                  ->raw_values();
+          queries.insert(queries.end(), values + begin,
+                         values + begin + dataset->dim_);
+        }
+      }
+    }
+  } while (recordBatch);
+
+  return queries;
+}
+
+// SELECT ... ORDER BY <vector field> <operator>, the query vector and the
+// LIMIT clause follow
+// predicate is an attribute filter of a synthetic filtered workload, the
+// filters of the dataset and it are never combined
+std::string generateFromClause(const DataSet *dataset,
+                               const std::optional<std::string> &table_name,
+                               const std::string &predicate) {
   std::ostringstream oss;
-  oss << "SELECT id FROM "
+  oss << " FROM "
       << (table_name.has_value() ? table_name.value() : dataset->name_);
   if (!dataset->filter_fields_.empty()) {
     oss << " WHERE ";
@@ -170,72 +213,82 @@ prepareParquetQueries(const DataSet *dataset,
       oss << std::get<3>(filter); // value
       oss << std::get<4>(filter); // epilogue
     }
+  } else if (!predicate.empty()) {
+    oss << " WHERE " << predicate;
   }
-  oss << " ORDER BY " << dataset->vector_field_ << " "
-      << metric2operator(dataset->metric_) << " ";
+  return oss.str();
+}
 
-  std::string sql_prefix = oss.str();
+// a query is prefix, the query vector, suffix and the limit. When the
+// distance is returned, the vector goes into the target list and the rows
+// are ordered by its alias, which still uses the index.
+std::string generateQueryPrefix(const DataSet *dataset,
+                                const std::optional<std::string> &table_name,
+                                const std::string &predicate,
+                                bool with_distance) {
+  std::ostringstream oss;
+  if (with_distance) {
+    oss << "SELECT id, " << dataset->vector_field_ << " "
+        << metric2operator(dataset->metric_) << " ";
+  } else {
+    oss << "SELECT id" << generateFromClause(dataset, table_name, predicate)
+        << " ORDER BY " << dataset->vector_field_ << " "
+        << metric2operator(dataset->metric_) << " ";
+  }
+  return oss.str();
+}
 
-  std::shared_ptr<arrow::RecordBatch> recordBatch;
-  do {
-    status = rb_reader->ReadNext(&recordBatch);
-    if (!status.ok()) {
-      SPDLOG_ERROR("read next batch failed: {}", status.ToString());
-      std::exit(1);
-    }
-    if (recordBatch) {
-      auto id_array =
-          std::static_pointer_cast<arrow::Int64Array>(recordBatch->column(0));
-      auto list_array =
-          std::static_pointer_cast<arrow::ListArray>(recordBatch->column(1));
-      size_t begin = 0;
-      if constexpr (std::is_same_v<DataType, float>) {
-        auto float_array =
-            std::static_pointer_cast<arrow::FloatArray>(list_array->values());
-        for (size_t i = 0; i < recordBatch->num_rows(); i++) {
-          oss << "'[";
-          size_t end = begin + dataset->dim_;
-          for (int j = begin; j < end; j++) {
-            f2s_buffered(float_array->Value(j), result);
-            oss << result;
-            if (j != end - 1) {
-              oss << ",";
-            }
-          }
-          oss << "]' LIMIT " << top_k2 << ";";
-          begin = end;
-          queries.push_back(oss.str());
-          oss.str("");
-          oss << sql_prefix;
-        }
-      } else {
-        auto double_array =
-            std::static_pointer_cast<arrow::DoubleArray>(list_array->values());
-        for (size_t i = 0; i < recordBatch->num_rows(); i++) {
-          oss << "'[";
-          size_t end = begin + dataset->dim_;
-          for (int j = begin; j < end; j++) {
-            d2s_buffered(double_array->Value(j), result);
-            oss << result;
-            if (j != end - 1) {
-              oss << ",";
-            }
-          }
-          oss << "]' LIMIT " << top_k2 << ";";
-          begin = end;
-          queries.push_back(oss.str());
-          oss.str("");
-          oss << sql_prefix;
-        }
-      }
+std::string generateQuerySuffix(const DataSet *dataset,
+                                const std::optional<std::string> &table_name,
+                                const std::string &predicate,
+                                bool with_distance) {
+  if (with_distance) {
+    return " AS distance" + generateFromClause(dataset, table_name, predicate) +
+           " ORDER BY distance LIMIT ";
+  }
+  return " LIMIT ";
+}
+
+// a query vector as a quoted pgvector literal
+std::string vectorLiteral(const float *vecs, size_t dim) {
+  char result[16]; // used for converting floating point numbers to decimal
+                   // strings
+  std::ostringstream oss;
+  oss << "'[";
+  for (size_t j = 0; j < dim; j++) {
+    f2s_buffered(vecs[j], result);
+    oss << result;
+    if (j != dim - 1) {
+      oss << ',';
     }
-  } while (recordBatch);
+  }
+  oss << "]'";
+  return oss.str();
+}
+
+// bake a query vector into a SQL literal
+std::string generateQuery(const std::string &sql_prefix,
+                          const std::string &sql_suffix, const float *vecs,
+                          size_t dim, size_t top_k2) {
+  return sql_prefix + vectorLiteral(vecs, dim) + sql_suffix +
+         std::to_string(top_k2) + ";";
+}
 
+std::vector<std::string> generateQueries(const std::string &sql_prefix,
+                                         const std::string &sql_suffix,
+                                         const QuerySet &qs, size_t top_k2,
+                                         ThreadPool &pool) {
+  std::vector<std::string> queries(qs.count);
+  pool.parallelFor(qs.count, [&](size_t, size_t i) {
+    queries[i] =
+        generateQuery(sql_prefix, sql_suffix, qs.vector(i), qs.dim, top_k2);
+  });
   return queries;
 }
 
-std::vector<std::vector<int64_t>>
-prepareParquetGroundTruths(const DataSet *dataset, size_t top_k1) {
+// Read the ground truth of a Parquet dataset, see prepareVecsGroudTruths
+std::vector<int64_t> prepareParquetGroundTruths(const DataSet *dataset,
+                                                size_t top_k1) {
   assert(top_k1 <= dataset->gt_topk_);
   // ground truth file path
   auto file_path = dataset->location_ + dataset->gt_file_.first;
@@ -267,8 +320,7 @@ prepareParquetGroundTruths(const DataSet *dataset, size_t top_k1) {
     std::exit(1);
   }
 
-  std::vector<std::vector<int64_t>> gts(dataset->gt_file_.second,
-                                        std::vector<int64_t>(top_k1));
+  std::vector<int64_t> gts(dataset->gt_file_.second * top_k1);
 
   std::shared_ptr<arrow::RecordBatch> recordBatch;
   do {
@@ -287,11 +339,11 @@ prepareParquetGroundTruths(const DataSet *dataset, size_t top_k1) {
       for (size_t i = 0; i < recordBatch->num_rows(); i++) {
         size_t begin = list_array->value_offset(i * 2);
         size_t end = list_array->value_offset((i + 1) * 2);
+        int64_t *gt = gts.data() + id_array->Value(i) * top_k1;
         for (int j = begin; j < begin + top_k1; j++) {
-          gts[id_array->Value(i)][j - begin] = int_array->Value(j);
+          gt[j - begin] = int_array->Value(j);
         }
-        std::sort(gts[id_array->Value(i)].begin(),
-                  gts[id_array->Value(i)].end());
+        std::sort(gt, gt + top_k1);
       }
     }
   } while (recordBatch);
@@ -299,38 +351,514 @@ prepareParquetGroundTruths(const DataSet *dataset, size_t top_k1) {
   return gts;
 }
 
-template <typename T>
-std::string
-percentile2str(Percentile<T> p,
-               const std::vector<std::pair<std::string, double>> &percentages) {
-  std::ostringstream oss;
-  oss << "best=" << p.best() << " worst=" << p.worst()
-      << " average=" << p.average();
+enum class Arrival : uint8_t {
+  UNIFORM, // fixed gap of 1/rate between queries
+  POISSON, // exponentially distributed gaps with mean 1/rate
+};
 
-  for (auto it = percentages.begin(); it != percentages.end(); it++) {
-    oss << " P(" << it->first << "%)=" << p(it->second);
+// Hands out query indexes in order, each along with the time it is intended
+// to start at so that the offered load follows the rate no matter how long
+// earlier queries take. Shared by all query threads.
+class ArrivalSchedule {
+public:
+  ArrivalSchedule(double rate, Arrival arrival, size_t total, uint64_t seed)
+      : rate_(rate), arrival_(arrival), total_(total), rng_(seed),
+        gap_(rate) {}
+
+  void start(std::chrono::high_resolution_clock::time_point begin) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    begin_ = begin;
   }
 
-  return oss.str();
+  // return false once all queries have been handed out
+  bool next(size_t &idx,
+            std::chrono::high_resolution_clock::time_point &intended) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (issued_ >= total_) {
+      return false;
+    }
+    idx = issued_++;
+    intended = begin_ + std::chrono::duration_cast<
+                            std::chrono::high_resolution_clock::duration>(
+                            std::chrono::duration<double>(offset_));
+    offset_ += arrival_ == Arrival::POISSON ? gap_(rng_) : 1.0 / rate_;
+    return true;
+  }
+
+private:
+  std::mutex mutex_;
+  double rate_;
+  Arrival arrival_;
+  size_t total_;
+  size_t issued_{0};
+  double offset_{0.0}; // seconds since begin_ of the next query
+  std::chrono::high_resolution_clock::time_point begin_;
+  std::mt19937_64 rng_;
+  std::exponential_distribution<double> gap_;
+};
+
+// the session GUC an option sets, pgvector's own hnsw.* and ivfflat.*
+// options go through as they are, any other GUC is given as set.<name>
+std::optional<std::string> gucName(const std::string &key) {
+  if (key.rfind("hnsw.", 0) == 0 || key.rfind("ivfflat.", 0) == 0) {
+    return key;
+  }
+  if (key.rfind("set.", 0) == 0 && key.size() > 4) {
+    return key.substr(4);
+  }
+  return std::nullopt;
+}
+
+// options setting a GUC, sorted so that SETs and labels are stable
+std::vector<std::string>
+gucOptions(const std::unordered_map<std::string, std::string> &query_opt_map) {
+  std::vector<std::string> keys;
+  for (const auto &[key, value] : query_opt_map) {
+    if (gucName(key).has_value()) {
+      keys.push_back(key);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  return keys;
 }
 
 std::vector<std::string> generateQueryOptions(
     const std::unordered_map<std::string, std::string> &query_opt_map) {
   std::vector<std::string> sqls;
+  for (const auto &key : gucOptions(query_opt_map)) {
+    std::string name = gucName(key).value();
+    if (!std::all_of(name.begin(), name.end(), [](unsigned char c) {
+          return std::isalnum(c) || c == '_' || c == '.';
+        })) {
+      SPDLOG_ERROR("Illegal GUC name: {}", name);
+      std::exit(1);
+    }
+    // values are quoted, which every GUC type accepts
+    std::string value;
+    for (char c : query_opt_map.at(key)) {
+      value += c == '\'' ? "''" : std::string(1, c);
+    }
+    sqls.push_back(fmt::format("SET {} = '{}'", name, value));
+  }
+  return sqls;
+}
 
-  // hnsw
-  if (query_opt_map.find("hnsw.ef_search") != query_opt_map.end()) {
-    sqls.push_back(fmt::format("SET hnsw.ef_search = {}",
-                               query_opt_map.at("hnsw.ef_search")));
+// the scan node of a text EXPLAIN, e.g. Index Scan using items_idx on items
+std::string planSummary(PGresult *res) {
+  for (int i = 0; i < PQntuples(res); i++) {
+    std::string line = PQgetvalue(res, i, 0);
+    if (line.find("Scan") == std::string::npos) {
+      continue;
+    }
+    size_t begin = line.find_first_not_of(" ->");
+    size_t end = line.find("  (");
+    return line.substr(begin, end == std::string::npos ? end : end - begin);
   }
+  return "unknown";
+}
 
-  // ivfflat
-  if (query_opt_map.find("ivfflat.probes") != query_opt_map.end()) {
-    sqls.push_back(fmt::format("SET ivfflat.probes = {}",
-                               query_opt_map.at("ivfflat.probes")));
+// explain one query on a connection of its own with the options of a point,
+// so that the report states the strategy the planner picked
+std::string samplePlan(const ClientFactory *cf,
+                       const std::vector<std::string> &query_options,
+                       const std::string &sql) {
+  auto client = cf->createClient();
+  for (const auto &query_option : query_options) {
+    if (!client->executeQuery(query_option.c_str(),
+                              [](PGresult *res) -> bool { return true; })) {
+      return "unknown";
+    }
   }
+  std::string plan = "unknown";
+  client->executeQuery(("EXPLAIN " + sql).c_str(), [&](PGresult *res) -> bool {
+    plan = planSummary(res);
+    return true;
+  });
+  return plan;
+}
 
-  return sqls;
+// the filter clause of the dataset and the attribute filter, part of what the
+// ground truth depends on
+std::string filterClause(const DataSet *dataset,
+                         const std::string &attribute_key) {
+  std::string clause;
+  for (const auto &filter : dataset->filter_fields_) {
+    clause += std::get<0>(filter) + std::get<1>(filter) + std::get<2>(filter) +
+              std::get<3>(filter) + std::get<4>(filter);
+  }
+  return clause + attribute_key;
+}
+
+// one cache file per dataset, k1, ground truth source and filter
+std::string queryCachePath(const DataSet *dataset, const std::string &dir,
+                           size_t top_k1, bool compute_gt,
+                           const std::string &attribute_key) {
+  return fmt::format("{}{}.k{}.{}.{:08x}.qcache", dir, dataset->name_, top_k1,
+                     compute_gt ? "computed" : "file",
+                     util::QueryCache::hash(
+                         filterClause(dataset, attribute_key)) &
+                         0xffffffff);
+}
+
+// covers the key and the files the cached content was read or computed from
+uint64_t queryCacheFingerprint(const DataSet *dataset, size_t top_k1,
+                               bool compute_gt,
+                               const std::string &attribute_key) {
+  std::string key = fmt::format("{}|{}|{}|{}|{}", dataset->name_,
+                                dataset->dim_, top_k1, compute_gt,
+                                filterClause(dataset, attribute_key));
+  key += "|" + util::QueryCache::fileStamp(dataset->location_ +
+                                           dataset->query_file_.first);
+  if (compute_gt) {
+    for (const auto &base_file : dataset->base_files_) {
+      key += "|" + util::QueryCache::fileStamp(dataset->location_ +
+                                               base_file.first);
+    }
+  } else {
+    key += "|" + util::QueryCache::fileStamp(dataset->location_ +
+                                             dataset->gt_file_.first);
+  }
+  return util::QueryCache::hash(key);
+}
+
+// thread_num of one sweep point, twice the number of cores by default
+size_t parseThreadNum(
+    const std::unordered_map<std::string, std::string> &query_opt_map) {
+  size_t thread_num = std::thread::hardware_concurrency() * 2;
+  auto tn = Util::getValueFromMap(query_opt_map, "thread_num");
+  if (tn.has_value()) {
+    thread_num = std::stoul(tn.value());
+  }
+  return thread_num;
+}
+
+// options that accept a comma separated list of values to sweep over, the
+// last one varies fastest
+// thread_num and every GUC option, each of them may be given a list
+std::vector<std::string>
+sweepOptions(const std::unordered_map<std::string, std::string> &opt_map) {
+  std::vector<std::string> keys = {"thread_num"};
+  for (const auto &key : gucOptions(opt_map)) {
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+// expand the swept options into one option map per combination of values
+std::vector<std::unordered_map<std::string, std::string>> expandSweep(
+    const std::unordered_map<std::string, std::string> &query_opt_map) {
+  std::vector<std::unordered_map<std::string, std::string>> points = {
+      query_opt_map};
+  for (const auto &key : sweepOptions(query_opt_map)) {
+    auto value = Util::getValueFromMap(query_opt_map, key);
+    if (!value.has_value()) {
+      continue;
+    }
+    std::vector<std::string> values;
+    CSVParser::parseLine(*value,
+                         [&](std::string &token) { values.push_back(token); });
+    if (values.empty()) {
+      SPDLOG_ERROR("Illegal {} value: {}", key, value.value());
+      std::exit(1);
+    }
+    std::vector<std::unordered_map<std::string, std::string>> expanded;
+    for (const auto &point : points) {
+      for (const auto &v : values) {
+        expanded.push_back(point);
+        expanded.back()[key] = v;
+      }
+    }
+    points = std::move(expanded);
+  }
+  return points;
+}
+
+std::string
+sweepLabel(const std::unordered_map<std::string, std::string> &point_opt_map,
+           size_t thread_num) {
+  std::string label = fmt::format("thread_num={}", thread_num);
+  for (const auto &key : sweepOptions(point_opt_map)) {
+    auto value = Util::getValueFromMap(point_opt_map, key);
+    if (key != "thread_num" && value.has_value()) {
+      label += fmt::format(" {}={}", key, value.value());
+    }
+  }
+  return label;
+}
+
+// report.csv turns into report.<point>.csv for each point of a sweep
+std::string pointFileName(const std::string &file_name,
+                          const std::string &point) {
+  size_t dot = file_name.rfind('.');
+  size_t slash = file_name.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return fmt::format("{}.{}", file_name, point);
+  }
+  return fmt::format("{}.{}{}", file_name.substr(0, dot), point,
+                     file_name.substr(dot));
+}
+
+// quality of one answer judged by distances instead of ids
+struct DistanceQuality {
+  float recall; // returned neighbors within the kth true distance
+  float ndcg;   // the same hits discounted by their rank
+  float error;  // mean relative error of the distance at each rank
+};
+
+// returned holds top_k2 distances in the order they came back, truth the
+// top_k1 true distances closest first. Both are padded with infinity when a
+// filter leaves fewer than k rows, only the finite ones count.
+DistanceQuality distanceQuality(const float *returned, size_t top_k2,
+                                const float *truth, size_t top_k1) {
+  size_t valid = 0;
+  float kth = 0.0f;
+  for (size_t j = 0; j < top_k1; j++) {
+    if (std::isfinite(truth[j])) {
+      kth = truth[j];
+      valid++;
+    }
+  }
+  if (valid == 0) {
+    // nothing to find, nothing missed
+    return DistanceQuality{1.0f, 1.0f, 0.0f};
+  }
+  const float threshold =
+      kth + distance_tolerance * std::max(1.0f, std::fabs(kth));
+  auto hit = [&](float distance) {
+    return std::isfinite(distance) && distance <= threshold;
+  };
+
+  size_t hits = 0;
+  for (size_t j = 0; j < top_k2; j++) {
+    hits += hit(returned[j]);
+  }
+
+  double dcg = 0.0, idcg = 0.0, error = 0.0;
+  size_t ranks = 0;
+  for (size_t j = 0; j < top_k1; j++) {
+    double discount = 1.0 / std::log2(j + 2.0);
+    if (std::isfinite(truth[j])) {
+      idcg += discount;
+    }
+    if (hit(returned[j])) {
+      dcg += discount;
+    }
+    if (std::isfinite(returned[j]) && std::isfinite(truth[j])) {
+      error += (returned[j] - truth[j]) /
+               std::max(std::fabs(truth[j]), distance_tolerance);
+      ranks++;
+    }
+  }
+
+  DistanceQuality quality;
+  quality.recall = static_cast<float>(std::min(hits, valid)) / valid;
+  quality.ndcg = static_cast<float>(std::min(1.0, dcg / idcg));
+  quality.error = ranks > 0 ? static_cast<float>(error / ranks) : 0.0f;
+  return quality;
+}
+
+// server side cost of one query sampled with EXPLAIN ANALYZE
+struct ExplainSample {
+  double planning_ms{0.0};
+  double execution_ms{0.0};
+  uint64_t shared_hit{0};  // blocks found in shared buffers
+  uint64_t shared_read{0}; // blocks read from the kernel
+  std::string scan;        // scan node, with its index if there is one
+};
+
+// the string or number following "key": in EXPLAIN's JSON output, starting
+// the search at from
+std::optional<std::string> explainValue(const std::string &json,
+                                        const std::string &key,
+                                        size_t from = 0) {
+  size_t pos = json.find("\"" + key + "\":", from);
+  if (pos == std::string::npos) {
+    return std::nullopt;
+  }
+  pos = json.find_first_not_of(' ', pos + key.size() + 3);
+  if (pos == std::string::npos) {
+    return std::nullopt;
+  }
+  if (json[pos] == '"') {
+    size_t end = json.find('"', pos + 1);
+    return json.substr(pos + 1, end - pos - 1);
+  }
+  size_t end = json.find_first_of(",}\n", pos);
+  return json.substr(pos, end - pos);
+}
+
+// Buffer counts of a plan node include its children, so the first ones,
+// which belong to the top node, cover the whole query.
+ExplainSample parseExplain(const std::string &json) {
+  ExplainSample sample;
+  auto number = [&](const std::string &key) {
+    auto value = explainValue(json, key);
+    return value.has_value() ? std::stod(value.value()) : 0.0;
+  };
+  sample.planning_ms = number("Planning Time");
+  sample.execution_ms = number("Execution Time");
+  sample.shared_hit = static_cast<uint64_t>(number("Shared Hit Blocks"));
+  sample.shared_read = static_cast<uint64_t>(number("Shared Read Blocks"));
+
+  size_t pos = 0;
+  while ((pos = json.find("\"Node Type\":", pos)) != std::string::npos) {
+    std::string node = explainValue(json, "Node Type", pos).value_or("");
+    size_t next = json.find("\"Node Type\":", pos + 1);
+    pos++;
+    if (node.find("Scan") == std::string::npos) {
+      continue;
+    }
+    sample.scan = node;
+    size_t index = json.find("\"Index Name\":", pos);
+    if (index != std::string::npos && index < next) {
+      sample.scan += " using " + explainValue(json, "Index Name", pos).value();
+    }
+    break;
+  }
+  return sample;
+}
+
+// Collects the sampled queries while the benchmark runs and explains them
+// under EXPLAIN (ANALYZE, BUFFERS) on a connection of its own once it is
+// over, so that they add no load to the server inside the measured window.
+// Samples beyond max_samples are dropped.
+class ExplainSampler {
+public:
+  ExplainSampler(std::unique_ptr<Client> client,
+                 std::function<std::string(size_t)> statement)
+      : client_(std::move(client)), statement_(std::move(statement)) {}
+
+  void sample(size_t q_idx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.size() >= max_samples) {
+      dropped_++;
+      return;
+    }
+    pending_.push_back(q_idx);
+  }
+
+  // explain the samples collected so far, call it once the benchmark
+  // threads are done
+  void finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t q_idx : pending_) {
+      std::string json;
+      client_->executeQuery(statement_(q_idx).c_str(),
+                            [&](PGresult *res) -> bool {
+                              for (int r = 0; r < PQntuples(res); r++) {
+                                json += PQgetvalue(res, r, 0);
+                              }
+                              return true;
+                            });
+      if (!json.empty()) {
+        samples_.push_back(parseExplain(json));
+      }
+    }
+    pending_.clear();
+  }
+
+  const std::vector<ExplainSample> &samples() const { return samples_; }
+  size_t dropped() const { return dropped_; }
+
+private:
+  static constexpr size_t max_samples = 1000;
+
+  std::unique_ptr<Client> client_;
+  std::function<std::string(size_t)> statement_;
+  std::mutex mutex_;
+  std::vector<size_t> pending_;
+  size_t dropped_{0};
+  std::vector<ExplainSample> samples_;
+};
+
+// log the distributions of the sampled server side costs
+void reportExplainSamples(
+    const ExplainSampler &explainer,
+    const std::vector<std::pair<std::string, double>> &percentages) {
+  Percentile<double> p_planning(true);
+  Percentile<double> p_execution(true);
+  Percentile<uint64_t> p_hit(true);
+  Percentile<uint64_t> p_read(true);
+  std::map<std::string, size_t> scans;
+  size_t sampled = 0;
+  for (const auto &sample : explainer.samples()) {
+    p_planning.add(sample.planning_ms);
+    p_execution.add(sample.execution_ms);
+    p_hit.add(sample.shared_hit);
+    p_read.add(sample.shared_read);
+    scans[sample.scan.empty() ? "unknown" : sample.scan]++;
+    sampled++;
+  }
+  if (explainer.dropped() > 0) {
+    SPDLOG_WARN("dropped {} samples beyond the first {} explained",
+                explainer.dropped(), explainer.samples().size());
+  }
+  if (sampled == 0) {
+    return;
+  }
+  std::string scan_counts;
+  for (const auto &[scan, n] : scans) {
+    scan_counts += fmt::format("{}{} x{}", scan_counts.empty() ? "" : ", ",
+                               scan, n);
+  }
+  SPDLOG_INFO("explained {} sampled queries, scans: {}", sampled,
+              scan_counts);
+  SPDLOG_INFO("planning time(ms): {}", percentile2str(p_planning, percentages));
+  SPDLOG_INFO("execution time(ms): {}",
+              percentile2str(p_execution, percentages));
+  SPDLOG_INFO("shared hit blocks: {}", percentile2str(p_hit, percentages));
+  SPDLOG_INFO("shared read blocks: {}", percentile2str(p_read, percentages));
+}
+
+struct SweepResult {
+  std::string label;
+  double qps;
+  double recall; // average recall
+  double p50;    // latency in microseconds
+  double p99;
+  std::string plan;   // scan node of a sampled EXPLAIN
+  bool pareto{false}; // no other point has both higher recall and qps
+};
+
+// log the sweep as a table, and write it as JSON if sweep_file is given
+void reportSweep(std::vector<SweepResult> &results,
+                 const std::optional<std::string> &sweep_file) {
+  for (auto &result : results) {
+    result.pareto = std::none_of(
+        results.begin(), results.end(), [&](const SweepResult &other) {
+          return other.recall >= result.recall && other.qps >= result.qps &&
+                 (other.recall > result.recall || other.qps > result.qps);
+        });
+  }
+
+  SPDLOG_INFO("{:<48} {:>12} {:>8} {:>12} {:>12} {:>6}  {}", "point", "qps",
+              "recall", "p50(us)", "p99(us)", "pareto", "plan");
+  for (const auto &result : results) {
+    SPDLOG_INFO("{:<48} {:>12.1f} {:>8.4f} {:>12.1f} {:>12.1f} {:>6}  {}",
+                result.label, result.qps, result.recall, result.p50,
+                result.p99, result.pareto ? "*" : "", result.plan);
+  }
+
+  if (!sweep_file.has_value()) {
+    return;
+  }
+  std::ofstream out(sweep_file.value(), std::ios::out | std::ios::trunc);
+  if (!out) {
+    SPDLOG_ERROR("failed to open sweep file: {}", sweep_file.value());
+    return;
+  }
+  out << "[\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto &result = results[i];
+    out << fmt::format(
+        "  {{\"point\":\"{}\",\"qps\":{:.1f},\"recall\":{:.6f},"
+        "\"p50_us\":{:.1f},\"p99_us\":{:.1f},\"plan\":\"{}\","
+        "\"pareto\":{}}}{}\n",
+        Util::jsonEscape(result.label), result.qps, result.recall,
+        result.p50, result.p99, Util::jsonEscape(result.plan), result.pareto,
+        i + 1 < results.size() ? "," : "");
+  }
+  out << "]\n";
 }
 
 } // namespace
@@ -340,6 +868,117 @@ void query(const DataSet *dataset, const ClientFactory *cf,
   assert(dataset != nullptr);
   assert(cf != nullptr);
 
+  // parse selectivity, a list runs the whole phase once per selectivity since
+  // the queries and their ground truth differ, files get the selectivity
+  // appended to their name
+  auto sel = Util::getValueFromMap(query_opt_map, "selectivity");
+  if (sel.has_value() && sel->find(',') != std::string::npos) {
+    CSVParser::parseLine(*sel, [&](std::string &token) {
+      auto sel_opt_map = query_opt_map;
+      sel_opt_map["selectivity"] = token;
+      for (const char *key : {"report_file", "sweep_file"}) {
+        auto file = Util::getValueFromMap(query_opt_map, key);
+        if (file.has_value()) {
+          sel_opt_map[key] = pointFileName(file.value(), "sel" + token);
+        }
+      }
+      SPDLOG_INFO("selectivity: {}", token);
+      query(dataset, cf, sel_opt_map);
+    });
+    return;
+  }
+
+  // parse gt, ground truth is either read from the files of the dataset or
+  // computed by brute force over the base set
+  bool compute_gt = false;
+  auto gt = Util::getValueFromMap(query_opt_map, "gt");
+  if (gt.has_value()) {
+    std::string lowercase = gt.value();
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (lowercase == "compute") {
+      compute_gt = true;
+    } else if (lowercase != "file") {
+      SPDLOG_ERROR("Illegal gt: {}", gt.value());
+      std::exit(1);
+    }
+  }
+
+  // parse attributes, selectivity and filter_attribute, queries of a
+  // synthetic filtered workload only consider rows whose attributes pass a
+  // predicate picked for the selectivity, its ground truth is computed
+  std::unique_ptr<AttributeGenerator> attribute_generator;
+  std::optional<AttributeFilter> attribute_filter;
+  std::string attribute_key;
+  if (sel.has_value()) {
+    auto attribute_options = parseAttributeOptions(query_opt_map);
+    if (!attribute_options.has_value()) {
+      SPDLOG_ERROR("selectivity requires the attributes given to load");
+      std::exit(1);
+    }
+    double selectivity = std::stod(sel.value());
+    if (selectivity <= 0.0 || selectivity > 1.0) {
+      SPDLOG_ERROR("Illegal selectivity value: {}", sel.value());
+      std::exit(1);
+    }
+    AttributeColumn column = AttributeColumn::CATEGORY;
+    auto fa = Util::getValueFromMap(query_opt_map, "filter_attribute");
+    if (fa.has_value()) {
+      std::string lowercase = fa.value();
+      std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (lowercase == "ts") {
+        column = AttributeColumn::TS;
+      } else if (lowercase == "tags") {
+        column = AttributeColumn::TAGS;
+      } else if (lowercase != "category") {
+        SPDLOG_ERROR("Illegal filter_attribute: {}", fa.value());
+        std::exit(1);
+      }
+    }
+    if (!dataset->filter_fields_.empty()) {
+      SPDLOG_ERROR("selectivity can not be used with filtered datasets");
+      std::exit(1);
+    }
+    attribute_generator = std::make_unique<AttributeGenerator>(
+        attribute_options.value(), dataset->dim_);
+    attribute_filter = attribute_generator->filterFor(column, selectivity);
+    const auto &options = attribute_options.value();
+    attribute_key = fmt::format(
+        "|{}|{}|{}|{}|{}|{}", attribute_filter->clause(),
+        static_cast<int>(options.distribution), options.seed,
+        options.categories, options.tags, options.tags_per_row);
+    SPDLOG_INFO("filter: {}, expected selectivity: {:.4f}",
+                attribute_filter->clause(), attribute_filter->expected);
+    compute_gt = true;
+  }
+  const std::string predicate =
+      attribute_filter.has_value() ? attribute_filter->clause() : "";
+
+  if (compute_gt && !dataset->filter_fields_.empty()) {
+    SPDLOG_ERROR("gt=compute does not support filtered datasets");
+    std::exit(1);
+  }
+  // parse distance, the distance of every returned neighbor is fetched as
+  // well and compared against the true ones, which tolerates ties
+  bool with_distance = false;
+  auto wd = Util::getValueFromMap(query_opt_map, "distance");
+  if (wd.has_value()) {
+    with_distance = Util::isYes(wd.value());
+  }
+  size_t gt_thread_num = std::thread::hardware_concurrency();
+  auto gtn = Util::getValueFromMap(query_opt_map, "gt_thread_num");
+  if (gtn.has_value()) {
+    gt_thread_num = std::stoul(gtn.value());
+  }
+  // parse io, direct, queue_depth and the rest of the read options, the
+  // ground truth scans read the VECS base files like load does
+  util::ReadOptions read_options = util::parseReadOptions(query_opt_map);
+
+  // computed ground truth is not limited to the top k of the files
+  const size_t max_top_k =
+      compute_gt ? std::numeric_limits<size_t>::max() : dataset->gt_topk_;
+
   // Find k2 nearest neighbors for each query vector, recall rate is k1@k2
   auto top_k1_opt = Util::getValueFromMap(query_opt_map, "k1");
   auto top_k2_opt = Util::getValueFromMap(query_opt_map, "k2");
@@ -347,7 +986,7 @@ void query(const DataSet *dataset, const ClientFactory *cf,
   size_t top_k2 = dataset->gt_topk_;
   if (top_k2_opt.has_value()) {
     top_k2 = std::stol(top_k2_opt.value());
-    if (top_k2 > dataset->gt_topk_ || top_k2 <= 0) {
+    if (top_k2 > max_top_k || top_k2 <= 0) {
       SPDLOG_ERROR("Illegal k2 value: {}", top_k2);
       std::exit(1);
     }
@@ -356,37 +995,146 @@ void query(const DataSet *dataset, const ClientFactory *cf,
   size_t top_k1 = top_k2;
   if (top_k1_opt.has_value()) {
     top_k1 = std::stol(top_k1_opt.value());
-    if (top_k1 > top_k2 || top_k1 <= 0 || top_k1 > dataset->gt_topk_) {
+    if (top_k1 > top_k2 || top_k1 <= 0 || top_k1 > max_top_k) {
       SPDLOG_ERROR("Illegal k1 value: {}", top_k1);
     }
   }
 
-  std::vector<std::string> queries;
-  std::vector<std::vector<int64_t>> gts;
   auto table_name = Util::getValueFromMap(query_opt_map, "table_name");
 
-  if (dataset->format_ == DataSetFormat::FVECS_FORMAT) {
-    queries = prepareVecsQueries<float>(dataset, table_name, top_k2);
-    gts = prepareVecsGroudTruths(dataset, top_k1);
-  } else if (dataset->format_ == DataSetFormat::BVECS_FORMAT) {
-    queries = prepareVecsQueries<uint8_t>(dataset, table_name, top_k2);
-    gts = prepareVecsGroudTruths(dataset, top_k1);
+  // parse cache, query vectors and ground truth are kept in a file under
+  // cache_dir (the dataset directory by default) that later runs map
+  std::unique_ptr<util::QueryCache> cache;
+  auto ch = Util::getValueFromMap(query_opt_map, "cache");
+  if (ch.has_value() && Util::isYes(ch.value())) {
+    std::string cache_dir = dataset->location_;
+    auto cd = Util::getValueFromMap(query_opt_map, "cache_dir");
+    if (cd.has_value()) {
+      cache_dir = cd.value();
+    }
+    if (!cache_dir.empty() && cache_dir.back() != '/') {
+      cache_dir += '/';
+    }
+    cache = std::make_unique<util::QueryCache>(
+        queryCachePath(dataset, cache_dir, top_k1, compute_gt, attribute_key),
+        queryCacheFingerprint(dataset, top_k1, compute_gt, attribute_key));
+  }
+
+  QuerySet qs;
+  bool loaded = cache && cache->load(qs);
+  if (loaded) {
+    SPDLOG_INFO("loaded queries and ground truth from {}", cache->path());
   } else {
-    assert(dataset->format_ == DataSetFormat::PARQUET_FORMAT);
-    if (dataset->base_type_ == DataSetBaseType::FLOAT) {
-      queries = prepareParquetQueries<float>(dataset, table_name, top_k2);
+    std::vector<float> query_vectors;
+    std::vector<int64_t> gts;
+    if (dataset->format_ == DataSetFormat::FVECS_FORMAT) {
+      query_vectors = prepareVecsQueries<float>(dataset);
+      if (!compute_gt) {
+        gts = prepareVecsGroudTruths(dataset, top_k1);
+      }
+    } else if (dataset->format_ == DataSetFormat::BVECS_FORMAT) {
+      query_vectors = prepareVecsQueries<uint8_t>(dataset);
+      if (!compute_gt) {
+        gts = prepareVecsGroudTruths(dataset, top_k1);
+      }
+    } else {
+      assert(dataset->format_ == DataSetFormat::PARQUET_FORMAT);
+      if (dataset->base_type_ == DataSetBaseType::FLOAT) {
+        query_vectors = prepareParquetQueries<float>(dataset);
+      } else {
+        assert(dataset->base_type_ == DataSetBaseType::DOUBLE);
+        query_vectors = prepareParquetQueries<double>(dataset);
+      }
+      if (!compute_gt) {
+        gts = prepareParquetGroundTruths(dataset, top_k1);
+      }
+    }
+    std::vector<float> gt_distances;
+    if (compute_gt) {
+      // rows passing the attribute filter, to report the actual selectivity
+      std::atomic<size_t> matched{0};
+      std::function<bool(int64_t, const float *)> filter;
+      if (attribute_filter.has_value()) {
+        filter = [&](int64_t id, const float *vec) {
+          bool match = attribute_filter->matches(
+              attribute_generator->generate(id, vec),
+              attribute_generator->options().tags_per_row);
+          if (match) {
+            matched.fetch_add(1, std::memory_order_relaxed);
+          }
+          return match;
+        };
+      }
+      gts = computeGroundTruths(dataset, query_vectors.data(),
+                                query_vectors.size() / dataset->dim_, top_k1,
+                                gt_thread_num, read_options,
+                                with_distance ? &gt_distances : nullptr,
+                                filter);
+      if (attribute_filter.has_value()) {
+        SPDLOG_INFO("actual selectivity: {:.4f} ({} of {} rows)",
+                    static_cast<double>(matched.load()) / dataset->total_cnt_,
+                    matched.load(), dataset->total_cnt_);
+      }
+    }
+    assert(gts.size() == query_vectors.size() / dataset->dim_ * top_k1);
+    qs.own(std::move(query_vectors), std::move(gts), dataset->dim_, top_k1);
+    if (with_distance && compute_gt) {
+      qs.ownDistances(std::move(gt_distances));
+    }
+  }
+  // ground truth files only carry ids, the distances come from the base set
+  if (with_distance && qs.dists == nullptr) {
+    qs.ownDistances(computeGroundTruthDistances(
+        dataset, qs.vectors, qs.gts, qs.count, qs.top_k, gt_thread_num,
+        read_options));
+    loaded = false;
+  }
+  if (cache && !loaded) {
+    if (cache->store(qs)) {
+      SPDLOG_INFO("saved queries and ground truth to {}", cache->path());
     } else {
-      assert(dataset->base_type_ == DataSetBaseType::DOUBLE);
-      queries = prepareParquetQueries<double>(dataset, table_name, top_k2);
+      SPDLOG_WARN("failed to save queries and ground truth to {}",
+                  cache->path());
     }
-    gts = prepareParquetGroundTruths(dataset, top_k1);
   }
 
-  size_t thread_num = std::thread::hardware_concurrency() * 2;
-  // parse thread num
-  auto tn = Util::getValueFromMap(query_opt_map, "thread_num");
-  if (tn.has_value()) {
-    thread_num = std::stoul(tn.value());
+  // parse prepared, a prepared statement takes the query vector as a binary
+  // parameter instead of parsing and planning a SQL literal every time
+  bool prepared = false;
+  auto pp = Util::getValueFromMap(query_opt_map, "prepared");
+  if (pp.has_value()) {
+    prepared = Util::isYes(pp.value());
+  }
+
+  // parse result_format, binary results carry the ids as big endian integers
+  // and spare the server the text conversion
+  int result_format = 1;
+  auto rf = Util::getValueFromMap(query_opt_map, "result_format");
+  if (rf.has_value()) {
+    std::string format = rf.value();
+    std::transform(format.begin(), format.end(), format.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (format == "binary") {
+      result_format = 1;
+    } else if (format == "text") {
+      result_format = 0;
+    } else {
+      SPDLOG_ERROR("Illegal result_format value: {}", rf.value());
+      std::exit(1);
+    }
+  }
+
+  const std::string sql_prefix =
+      generateQueryPrefix(dataset, table_name, predicate, with_distance);
+  const std::string sql_suffix =
+      generateQuerySuffix(dataset, table_name, predicate, with_distance);
+  const std::string prepared_sql = sql_prefix + "$1" + sql_suffix + "$2";
+  const std::string limit_param = std::to_string(top_k2);
+  // formats the queries and checks the answers on all cores
+  ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::string> queries;
+  if (!prepared) {
+    queries = generateQueries(sql_prefix, sql_suffix, qs, top_k2, pool);
   }
 
   // parse loop
@@ -396,6 +1144,80 @@ void query(const DataSet *dataset, const ClientFactory *cf,
     loop = std::stoul(lp.value());
   }
 
+  // parse pipeline depth, number of queries kept in flight on each connection
+  size_t pipeline_depth = 1;
+  auto pd = Util::getValueFromMap(query_opt_map, "pipeline_depth");
+  if (pd.has_value()) {
+    pipeline_depth = std::stoul(pd.value());
+    if (pipeline_depth == 0) {
+      SPDLOG_ERROR("Illegal pipeline_depth value: {}", pd.value());
+      std::exit(1);
+    }
+  }
+
+  // parse rate and arrival, with a rate queries are issued open loop at the
+  // offered rate instead of as fast as the threads can go
+  double rate = 0.0;
+  auto rt = Util::getValueFromMap(query_opt_map, "rate");
+  if (rt.has_value()) {
+    rate = std::stod(rt.value());
+    if (rate <= 0.0) {
+      SPDLOG_ERROR("Illegal rate value: {}", rt.value());
+      std::exit(1);
+    }
+    if (pipeline_depth > 1) {
+      SPDLOG_ERROR("rate can not be combined with pipeline_depth");
+      std::exit(1);
+    }
+  }
+  const bool open_loop = rate > 0.0;
+
+  Arrival arrival = Arrival::POISSON;
+  auto ar = Util::getValueFromMap(query_opt_map, "arrival");
+  if (ar.has_value()) {
+    std::string lowercase = ar.value();
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (lowercase == "uniform") {
+      arrival = Arrival::UNIFORM;
+    } else if (lowercase != "poisson") {
+      SPDLOG_ERROR("Illegal arrival: {}", ar.value());
+      std::exit(1);
+    }
+  }
+
+  // parse duration, queries are cycled until it has passed instead of being
+  // run loop times
+  std::optional<std::chrono::nanoseconds> duration;
+  auto du = Util::getValueFromMap(query_opt_map, "duration");
+  if (du.has_value()) {
+    duration = Util::parseDuration(du.value());
+    if (duration->count() <= 0) {
+      SPDLOG_ERROR("Illegal duration value: {}", du.value());
+      std::exit(1);
+    }
+  }
+
+  // parse warmup, either a time such as 30s or a number of queries, samples
+  // of the warm-up are left out of the statistics
+  std::optional<size_t> warmup_queries;
+  std::chrono::nanoseconds warmup_time{0};
+  auto wu = Util::getValueFromMap(query_opt_map, "warmup");
+  if (wu.has_value()) {
+    if (std::all_of(wu->begin(), wu->end(),
+                    [](unsigned char c) { return std::isdigit(c); })) {
+      warmup_queries = std::stoul(wu.value());
+    } else {
+      warmup_time = Util::parseDuration(wu.value());
+    }
+  }
+
+  uint64_t seed = default_seed;
+  auto sd = Util::getValueFromMap(query_opt_map, "seed");
+  if (sd.has_value()) {
+    seed = std::stoull(sd.value());
+  }
+
   // parse percentages
   std::vector<std::pair<std::string, double>> percentages;
   auto pct = Util::getValueFromMap(query_opt_map, "percentages");
@@ -406,109 +1228,590 @@ void query(const DataSet *dataset, const ClientFactory *cf,
     });
   }
 
-  // generate query options sql
-  std::vector<std::string> queryOptions = generateQueryOptions(query_opt_map);
-
-  // count of generated queries
-  const size_t count = queries.size();
+  // count of query vectors
+  const size_t count = qs.count;
   // execute loop times for all queries
   const size_t vcount = count * loop;
 
-  Percentile<uint32_t> p_latencies(true);
-  Percentile<float> p_recalls(false);
-  std::vector<uint32_t> latencies(vcount, 0);
-  std::vector<float> recalls(count, 0.0);
-  // each query return top_k2 ann
-  std::vector<std::vector<int64_t>> labels(count, std::vector<int64_t>(top_k2));
-
-  std::vector<std::thread> threads;
-  std::atomic<size_t> cursor{0};
-  auto all_start = std::chrono::high_resolution_clock::now();
-  for (size_t i = 0; i < thread_num; i++) {
-    threads.emplace_back([&]() {
-      auto client = cf->createClient();
-      // set query options if necessary
+  // parse explain_sample_rate, the fraction of measured queries run under
+  // EXPLAIN (ANALYZE, BUFFERS) on a connection of their own instead, they are
+  // left out of the statistics
+  double explain_sample_rate = 0.0;
+  auto es = Util::getValueFromMap(query_opt_map, "explain_sample_rate");
+  if (es.has_value()) {
+    explain_sample_rate = std::stod(es.value());
+    if (explain_sample_rate < 0.0 || explain_sample_rate > 1.0) {
+      SPDLOG_ERROR("Illegal explain_sample_rate value: {}", es.value());
+      std::exit(1);
+    }
+    if (explain_sample_rate > 0.0 && pipeline_depth > 1) {
+      SPDLOG_WARN("explain_sample_rate is ignored with pipeline_depth");
+      explain_sample_rate = 0.0;
+    }
+  }
+
+  // parse histogram precision, number of significant decimal digits kept for
+  // each latency sample
+  int histogram_precision = default_histogram_precision;
+  auto hp = Util::getValueFromMap(query_opt_map, "histogram_precision");
+  if (hp.has_value()) {
+    histogram_precision = std::stoi(hp.value());
+    if (histogram_precision < 1 || histogram_precision > 5) {
+      SPDLOG_ERROR("Illegal histogram_precision value: {}", hp.value());
+      std::exit(1);
+    }
+  }
+
+  // parse report_interval, report_file and report_format, a time series of
+  // per interval throughput and latency is reported while queries run
+  std::optional<std::chrono::milliseconds> report_interval;
+  auto report_file = Util::getValueFromMap(query_opt_map, "report_file");
+  ReportFormat report_format = ReportFormat::CSV;
+  auto ri = Util::getValueFromMap(query_opt_map, "report_interval");
+  if (ri.has_value()) {
+    report_interval = Util::parseDuration(ri.value());
+    if (report_interval->count() <= 0) {
+      SPDLOG_ERROR("Illegal report_interval value: {}", ri.value());
+      std::exit(1);
+    }
+    // json lines if the file name says so, csv otherwise
+    if (report_file.has_value() &&
+        report_file->rfind(".json") != std::string::npos) {
+      report_format = ReportFormat::JSON;
+    }
+    auto rf = Util::getValueFromMap(query_opt_map, "report_format");
+    if (rf.has_value()) {
+      std::string lowercase = rf.value();
+      std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (lowercase == "csv") {
+        report_format = ReportFormat::CSV;
+      } else if (lowercase == "json") {
+        report_format = ReportFormat::JSON;
+      } else {
+        SPDLOG_ERROR("Illegal report_format: {}", rf.value());
+        std::exit(1);
+      }
+    }
+  }
+
+  // every combination of the swept options is one point of the sweep, a run
+  // without lists is a single point
+  std::vector<std::unordered_map<std::string, std::string>> points =
+      expandSweep(query_opt_map);
+  size_t max_thread_num = 0;
+  for (const auto &point_opt_map : points) {
+    max_thread_num = std::max(max_thread_num, parseThreadNum(point_opt_map));
+  }
+
+  // connections, along with their prepared statement, are set up by the first
+  // point that needs them and reused by the following ones
+  std::vector<std::unique_ptr<Client>> clients(max_thread_num);
+  std::vector<SweepResult> results;
+
+  for (size_t point = 0; point < points.size(); point++) {
+    const auto &point_opt_map = points[point];
+    const size_t thread_num = parseThreadNum(point_opt_map);
+    // generate query options sql, they are issued again for every point
+    std::vector<std::string> queryOptions =
+        generateQueryOptions(point_opt_map);
+    std::string label = sweepLabel(point_opt_map, thread_num);
+    if (points.size() > 1) {
+      SPDLOG_INFO("sweep point {}/{}: {}", point + 1, points.size(), label);
+    }
+    std::string plan = samplePlan(
+        cf, queryOptions,
+        generateQuery(sql_prefix, sql_suffix, qs.vector(0), qs.dim, top_k2));
+    SPDLOG_INFO("plan: {}", plan);
+
+    auto waits = WaitEventSampler::create(cf, point_opt_map);
+    std::unique_ptr<IntervalReporter> reporter;
+    if (report_interval.has_value()) {
+      std::optional<std::string> point_file = report_file;
+      if (point_file.has_value() && points.size() > 1) {
+        point_file =
+            pointFileName(point_file.value(), std::to_string(point + 1));
+      }
+      reporter = std::make_unique<IntervalReporter>(
+          report_interval.value(), thread_num, max_trackable_latency_ns,
+          histogram_precision, 1000.0, point_file, report_format,
+          waits.get());
+    }
+
+    // sampled queries are explained with the options of the point, the
+    // prepared statement through EXECUTE so that its plan is the one measured
+    std::unique_ptr<ExplainSampler> explainer;
+    if (explain_sample_rate > 0.0) {
+      auto explain_client = cf->createClient();
+      if (prepared && !explain_client->prepare(prepared_stmt_name,
+                                               prepared_sql.c_str(), 2)) {
+        std::exit(1);
+      }
       for (const auto &queryOption : queryOptions) {
-        auto ret = client->executeQuery(
-            queryOption.c_str(), [&](PGresult *res) -> bool {
-              // no need to handle result
-              assert(PQresultStatus(res) == PGRES_COMMAND_OK);
-              SPDLOG_DEBUG("successfully excuted: {}", queryOption);
-              return true;
-            });
-        if (!ret) {
+        if (!explain_client->executeQuery(
+                queryOption.c_str(),
+                [](PGresult *res) -> bool { return true; })) {
           SPDLOG_ERROR("failed to execute: {}", queryOption);
         }
       }
-      while (true) {
-        size_t idx = cursor.fetch_add(1);
-        if (idx >= vcount) {
-          break;
+      explainer = std::make_unique<ExplainSampler>(
+          std::move(explain_client), [&](size_t q_idx) {
+            std::string sql = "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) ";
+            if (prepared) {
+              return sql + fmt::format("EXECUTE {}({}, {})",
+                                       prepared_stmt_name,
+                                       vectorLiteral(qs.vector(q_idx), qs.dim),
+                                       top_k2);
+            }
+            return sql + queries[q_idx];
+          });
+    }
+
+    // latencies are recorded in nanoseconds into one histogram per thread and
+    // reported in microseconds
+    std::vector<ThreadHistogram> thread_latencies;
+    thread_latencies.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; i++) {
+      thread_latencies.emplace_back(max_trackable_latency_ns,
+                                    histogram_precision, 1000.0);
+    }
+    HdrHistogram p_latencies(max_trackable_latency_ns, histogram_precision,
+                             1000.0);
+    // in open loop mode latencies are measured from the intended start time,
+    // the time actually spent executing each query is kept here as well
+    std::vector<ThreadHistogram> thread_service_times;
+    if (open_loop) {
+      thread_service_times.reserve(thread_num);
+      for (size_t i = 0; i < thread_num; i++) {
+        thread_service_times.emplace_back(max_trackable_latency_ns,
+                                          histogram_precision, 1000.0);
+      }
+    }
+    HdrHistogram p_service_times(max_trackable_latency_ns, histogram_precision,
+                                 1000.0);
+    Percentile<float> p_recalls(false);
+    std::vector<float> recalls(count, 0.0);
+    Percentile<float> p_tie_recalls(false);
+    Percentile<float> p_ndcgs(false);
+    Percentile<float> p_distance_errors(true);
+    std::vector<DistanceQuality> qualities(with_distance ? count : 0);
+    // each query return top_k2 ann laid out back to back, only the first
+    // answer of each distinct query is kept no matter how often it is repeated
+    std::vector<int64_t> labels(count * top_k2, -1);
+    // distances of the returned neighbors in the order they came back
+    std::vector<float> distances(with_distance ? count * top_k2 : 0,
+                                 std::numeric_limits<float>::infinity());
+    std::unique_ptr<std::atomic<bool>[]> answered(
+        new std::atomic<bool>[count]());
+    // answers with fewer than top_k2 rows, which a strictly ordered index
+    // scan returns when the filter removes too many of its candidates
+    std::atomic<size_t> answers{0};
+    std::atomic<size_t> short_answers{0};
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> cursor{0};
+    // queries handed out after the warm-up, bounded by vcount unless a
+    // duration is given
+    std::atomic<size_t> measured{0};
+    // when the measured part of the run started in nanoseconds since
+    // all_start, -1 while a warm-up given in queries is still going on
+    std::atomic<int64_t> measure_start{
+        warmup_queries.has_value() ? -1 : warmup_time.count()};
+    std::unique_ptr<ArrivalSchedule> schedule;
+    if (open_loop) {
+      schedule = std::make_unique<ArrivalSchedule>(
+          rate, arrival, std::numeric_limits<size_t>::max(), seed);
+    }
+
+    // threads connect and set up their sessions first, the clock starts once
+    // every one of them is ready
+    std::mutex gate_mutex;
+    std::condition_variable gate;
+    size_t ready = 0;
+    bool go = false;
+
+    std::chrono::high_resolution_clock::time_point all_start;
+    for (size_t i = 0; i < thread_num; i++) {
+      threads.emplace_back([&, i]() {
+        if (!clients[i]) {
+          clients[i] = cf->createClient();
+          if (prepared && !clients[i]->prepare(prepared_stmt_name,
+                                               prepared_sql.c_str(), 2)) {
+            std::exit(1);
+          }
         }
-        size_t q_idx = idx % count;
+        Client *client = clients[i].get();
+        HdrHistogram &latencies = thread_latencies[i].histogram;
+        std::mt19937_64 sample_rng(seed + i);
+        std::uniform_real_distribution<double> sample_dist(0.0, 1.0);
+        // set query options if necessary
+        for (const auto &queryOption : queryOptions) {
+          auto ret = client->executeQuery(
+              queryOption.c_str(), [&](PGresult *res) -> bool {
+                // no need to handle result
+                assert(PQresultStatus(res) == PGRES_COMMAND_OK);
+                SPDLOG_DEBUG("successfully excuted: {}", queryOption);
+                return true;
+              });
+          if (!ret) {
+            SPDLOG_ERROR("failed to execute: {}", queryOption);
+          }
+        }
+
+        // binary vector parameter and text LIMIT parameter of the prepared
+        // statement, the vector is encoded before the query is timed
+        std::string vector_param;
+        const char *param_values[2] = {nullptr, limit_param.c_str()};
+        int param_lengths[2] = {0, 0};
+        const int param_formats[2] = {1, 0};
+        auto bind = [&](size_t q_idx) {
+          util::encodeVector(vector_param, qs.vector(q_idx), qs.dim);
+          param_values[0] = vector_param.data();
+          param_lengths[0] = static_cast<int>(vector_param.size());
+        };
 
-        auto start = std::chrono::high_resolution_clock::now();
-        auto ret = client->executeQuery(
-            queries[q_idx].c_str(), [&](PGresult *res) -> bool {
-              int num_rows = PQntuples(res);
+        auto result_handler = [&](size_t q_idx) {
+          return [&, q_idx](PGresult *res) -> bool {
+            answers.fetch_add(1, std::memory_order_relaxed);
+            if (static_cast<size_t>(PQntuples(res)) < top_k2) {
+              short_answers.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (answered[q_idx].exchange(true, std::memory_order_relaxed)) {
+              return true;
+            }
+            int num_rows = std::min<int>(PQntuples(res), top_k2);
+            int64_t *ls = labels.data() + q_idx * top_k2;
+            for (int j = 0; j < num_rows; j++) {
+              const char *value = PQgetvalue(res, j, 0);
+              ls[j] = result_format
+                          ? util::getInteger(value, PQgetlength(res, j, 0))
+                          : std::stoll(value);
+            }
+            if (with_distance) {
+              float *ds = distances.data() + q_idx * top_k2;
               for (int j = 0; j < num_rows; j++) {
-                const char *int_value_str = PQgetvalue(res, j, 0);
-                labels[q_idx][j] = std::stoi(int_value_str);
+                const char *value = PQgetvalue(res, j, 1);
+                ds[j] = result_format
+                            ? util::getFloat(value, PQgetlength(res, j, 1))
+                            : std::stof(value);
               }
-              return true;
-            });
-        auto end = std::chrono::high_resolution_clock::now();
-        uint32_t microseconds =
-            (std::chrono::duration_cast<std::chrono::microseconds>)(end - start)
-                .count();
-        latencies[idx] = microseconds;
-        SPDLOG_DEBUG("query {}: {}, execution time: {}", q_idx, queries[q_idx],
-                     microseconds);
-        if (!ret) {
-          SPDLOG_ERROR("failed to excute query {}", queries[idx]);
+            }
+            return true;
+          };
+        };
+
+        // decide whether the idx-th query, (intended to be) started at begin,
+        // is part of the warm-up, return false once the run is over
+        auto admit = [&](size_t idx,
+                         std::chrono::high_resolution_clock::time_point begin,
+                         bool &warm) -> bool {
+          int64_t since =
+              (std::chrono::duration_cast<std::chrono::nanoseconds>)(
+                  begin - all_start)
+                  .count();
+          warm = warmup_queries.has_value() ? idx < *warmup_queries
+                                            : since < warmup_time.count();
+          if (warm) {
+            return true;
+          }
+          int64_t expected = -1;
+          measure_start.compare_exchange_strong(expected, since);
+          if (duration.has_value()) {
+            return since < measure_start.load() + duration->count();
+          }
+          return measured.fetch_add(1) < vcount;
+        };
+
+        // latency runs from the intended start, which is the actual start
+        // unless queries follow an arrival schedule
+        auto record_latency = [&](size_t idx, auto intended, auto start,
+                                  bool ret, bool warm) {
+          auto end = std::chrono::high_resolution_clock::now();
+          size_t q_idx = idx % count;
+          uint64_t nanoseconds = (std::chrono::duration_cast<
+                                     std::chrono::nanoseconds>)(end - intended)
+                                     .count();
+          if (reporter) {
+            reporter->recorder(i).record(nanoseconds);
+            if (!ret) {
+              reporter->recorder(i).recordError();
+            }
+          }
+          if (!warm) {
+            latencies.record(nanoseconds);
+          }
+          if (open_loop && !warm) {
+            thread_service_times[i].histogram.record(
+                (std::chrono::duration_cast<std::chrono::nanoseconds>)(end -
+                                                                       start)
+                    .count());
+          }
+          SPDLOG_DEBUG("query {}: {}, execution time(ns): {}", q_idx,
+                       prepared ? prepared_sql : queries[q_idx], nanoseconds);
+          if (!ret) {
+            SPDLOG_ERROR("failed to excute query {}",
+                         prepared ? prepared_sql : queries[q_idx]);
+          }
+        };
+
+        {
+          std::unique_lock<std::mutex> lock(gate_mutex);
+          ready++;
+          gate.notify_all();
+          gate.wait(lock, [&] { return go; });
+        }
+
+        if (pipeline_depth > 1) {
+          if (!client->enterPipelineMode()) {
+            std::exit(1);
+          }
+          // queries in flight in send order, each with its send time and
+          // whether it belongs to the warm-up
+          std::deque<std::tuple<
+              size_t, std::chrono::high_resolution_clock::time_point, bool>>
+              inflight;
+          bool exhausted = false;
+          while (true) {
+            while (!exhausted && inflight.size() < pipeline_depth) {
+              size_t idx = cursor.fetch_add(1);
+              bool warm;
+              auto now = std::chrono::high_resolution_clock::now();
+              if (!admit(idx, now, warm)) {
+                exhausted = true;
+                break;
+              }
+              size_t q_idx = idx % count;
+              if (prepared) {
+                bind(q_idx);
+              }
+              auto start = std::chrono::high_resolution_clock::now();
+              bool sent = prepared ? client->sendPipelinePrepared(
+                                         prepared_stmt_name, 2, param_values,
+                                         param_lengths, param_formats,
+                                         result_format)
+                                   : client->sendPipelineQuery(
+                                         queries[q_idx].c_str(), result_format);
+              if (!sent) {
+                record_latency(idx, start, start, false, warm);
+                continue;
+              }
+              inflight.emplace_back(idx, start, warm);
+            }
+            if (inflight.empty()) {
+              break;
+            }
+            auto [idx, start, warm] = inflight.front();
+            inflight.pop_front();
+            auto ret = client->getPipelineResult(result_handler(idx % count));
+            record_latency(idx, start, start, ret, warm);
+          }
+          client->exitPipelineMode();
+          return;
+        }
+
+        while (true) {
+          size_t idx;
+          std::chrono::high_resolution_clock::time_point intended;
+          if (open_loop) {
+            if (!schedule->next(idx, intended)) {
+              break;
+            }
+          } else {
+            idx = cursor.fetch_add(1);
+            intended = std::chrono::high_resolution_clock::now();
+          }
+          bool warm;
+          if (!admit(idx, intended, warm)) {
+            break;
+          }
+          size_t q_idx = idx % count;
+
+          // sampled queries still run and count as usual, the explainer
+          // only notes them down to explain once the run is over
+          if (explainer && !warm &&
+              sample_dist(sample_rng) < explain_sample_rate) {
+            explainer->sample(q_idx);
+          }
+          if (prepared) {
+            bind(q_idx);
+          }
+          if (open_loop) {
+            std::this_thread::sleep_until(intended);
+          }
+          auto start = std::chrono::high_resolution_clock::now();
+          if (!open_loop) {
+            intended = start;
+          }
+          auto ret = prepared ? client->executePrepared(
+                                    prepared_stmt_name, 2, param_values,
+                                    param_lengths, param_formats,
+                                    result_handler(q_idx), result_format)
+                              : client->executeQuery(queries[q_idx].c_str(),
+                                                     result_handler(q_idx),
+                                                     result_format);
+          record_latency(idx, intended, start, ret, warm);
+        }
+      });
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(gate_mutex);
+      gate.wait(lock, [&] { return ready == thread_num; });
+      all_start = std::chrono::high_resolution_clock::now();
+      if (schedule) {
+        schedule->start(all_start);
+      }
+      if (waits) {
+        waits->start();
+      }
+      if (reporter) {
+        reporter->start(all_start);
+      }
+      go = true;
+    }
+    gate.notify_all();
+
+    for (size_t t = 0; t < thread_num; t++) {
+      threads[t].join();
+    }
+
+    auto all_end = std::chrono::high_resolution_clock::now();
+    if (reporter) {
+      reporter->stop();
+    }
+    if (waits) {
+      waits->stop();
+    }
+    // explained after all_end, so that the explaining adds no load to the
+    // measured window
+    if (explainer) {
+      explainer->finish();
+    }
+
+    for (const auto &thread_latency : thread_latencies) {
+      p_latencies.merge(thread_latency.histogram);
+    }
+    for (const auto &thread_service_time : thread_service_times) {
+      p_service_times.merge(thread_service_time.histogram);
+    }
+    if (p_latencies.empty()) {
+      SPDLOG_ERROR("no query finished after the warm-up");
+      std::exit(1);
+    }
+
+    // throughput of the measured part only
+    auto measure_begin =
+        all_start + std::chrono::nanoseconds(std::max<int64_t>(
+                        measure_start.load(), 0));
+    double qps =
+        1000000.0f * p_latencies.count() /
+        ((std::chrono::duration_cast<std::chrono::microseconds>)(all_end -
+                                                                 measure_begin)
+             .count());
+
+    // calculate recalls, once for each distinct query that got answered,
+    // distinct queries are split evenly over the cores
+    std::vector<uint8_t> has_recall(count, 0);
+    pool.parallelFor(count, [&](size_t, size_t i) {
+      if (!answered[i].load()) {
+        return;
+      }
+      int64_t *ls = labels.data() + i * top_k2;
+      std::sort(ls, ls + top_k2);
+      const int64_t *gs = qs.gt(i);
+      // both sides are padded with -1 when a filter leaves fewer than k
+      // rows, the padding is neither a neighbor nor a miss
+      size_t valid = std::count_if(gs, gs + top_k1,
+                                   [](int64_t id) { return id >= 0; });
+      size_t ig = 0, il = 0, correct = 0;
+      while (ig < top_k1 && il < top_k2) {
+        if (gs[ig] < 0) {
+          ig++;
+          continue;
+        }
+        if (ls[il] < 0) {
+          il++;
+          continue;
         }
+        int64_t diff = gs[ig] - ls[il];
+        if (diff < 0) {
+          ig++;
+        } else if (diff > 0) {
+          il++;
+        } else {
+          ig++;
+          il++;
+          correct++;
+        }
+      }
+      recalls[i] = valid > 0 ? (float)correct / valid : 1.0f;
+      if (with_distance) {
+        qualities[i] = distanceQuality(distances.data() + i * top_k2,
+                                       top_k2, qs.dist(i), top_k1);
       }
+      has_recall[i] = 1;
     });
-  }
+    size_t answered_count = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (has_recall[i]) {
+        recalls[answered_count++] = recalls[i];
+        if (with_distance) {
+          p_tie_recalls.add(qualities[i].recall);
+          p_ndcgs.add(qualities[i].ndcg);
+          p_distance_errors.add(qualities[i].error);
+        }
+      }
+    }
+    if (answered_count < count) {
+      SPDLOG_INFO("{} of {} distinct queries answered", answered_count, count);
+    }
+    if (short_answers.load() > 0) {
+      SPDLOG_INFO("{} of {} answers returned fewer than {} rows",
+                  short_answers.load(), answers.load(), top_k2);
+    }
 
-  for (size_t t = 0; t < thread_num; t++) {
-    threads[t].join();
-  }
-
-  auto all_end = std::chrono::high_resolution_clock::now();
-  double qps =
-      1000000.0f * vcount /
-      ((std::chrono::duration_cast<std::chrono::microseconds>)(all_end -
-                                                               all_start)
-           .count());
-
-  // calculate recalls
-  for (size_t i = 0; i < count; i++) {
-    std::sort(labels[i].begin(), labels[i].end());
-    const auto &ls = labels[i];
-    const auto &gs = gts[i];
-    size_t ig = 0, il = 0, correct = 0;
-    while (ig < top_k1 && il < top_k2) {
-      int64_t diff = gs[ig] - ls[il];
-      if (diff < 0) {
-        ig++;
-      } else if (diff > 0) {
-        il++;
-      } else {
-        ig++;
-        il++;
-        correct++;
+    p_recalls.add(recalls.data(), answered_count);
+    if (open_loop) {
+      SPDLOG_INFO("offered qps: {} ({}), achieved qps: {}", rate,
+                  arrival == Arrival::POISSON ? "poisson" : "uniform", qps);
+      SPDLOG_INFO("latency from intended start(us): {}",
+                  percentile2str(p_latencies, percentages));
+      SPDLOG_INFO("service time(us): {}",
+                  percentile2str(p_service_times, percentages));
+    } else {
+      SPDLOG_INFO("qps: {}", qps);
+      SPDLOG_INFO("latency(us): {}", percentile2str(p_latencies, percentages));
+    }
+    if (answered_count > 0) {
+      SPDLOG_INFO("recall: {}", percentile2str(p_recalls, percentages));
+      if (with_distance) {
+        SPDLOG_INFO("tie-aware recall: {}",
+                    percentile2str(p_tie_recalls, percentages));
+        SPDLOG_INFO("ndcg: {}", percentile2str(p_ndcgs, percentages));
+        SPDLOG_INFO("relative distance error: {}",
+                    percentile2str(p_distance_errors, percentages));
       }
     }
-    float rate = (float)correct / top_k1;
-    recalls[i] = rate;
+    if (explainer) {
+      reportExplainSamples(*explainer, percentages);
+    }
+    if (waits) {
+      waits->report("query");
+    }
+
+    SweepResult result;
+    result.label = label;
+    result.qps = qps;
+    result.recall = answered_count > 0 ? p_recalls.average() : 0.0;
+    result.p50 = p_latencies(50.0);
+    result.p99 = p_latencies(99.0);
+    result.plan = plan;
+    results.push_back(result);
   }
 
-  p_latencies.add(latencies.data(), vcount);
-  p_recalls.add(recalls.data(), count);
-  SPDLOG_INFO("qps: {}", qps);
-  SPDLOG_INFO("latency(us): {}", percentile2str(p_latencies, percentages));
-  SPDLOG_INFO("recall: {}", percentile2str(p_recalls, percentages));
+  if (points.size() > 1) {
+    reportSweep(results, Util::getValueFromMap(query_opt_map, "sweep_file"));
+  }
 }
 
 } // namespace pgvectorbench
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/exception.h>
+#include <spdlog/spdlog.h>
+
+#include "dataset/dataset.h"
+#include "utils/thread_pool.h"
+#include "utils/util.h"
+
+namespace fs = std::filesystem;
+
+namespace pgvectorbench {
+
+namespace {
+
+constexpr size_t default_row_group_size = 10000;
+
+// copy the rows of src into dst with at most row_group_size rows per row
+// group, batches are streamed so the file is never held in memory
+bool rewriteParquetFile(const std::string &src, const std::string &dst,
+                        size_t row_group_size) {
+  arrow::MemoryPool *pool = arrow::default_memory_pool();
+  auto reader_properties = parquet::ReaderProperties(pool);
+  reader_properties.set_buffer_size(2048 * 1024);
+  reader_properties.enable_buffered_stream();
+
+  auto arrow_reader_props = parquet::ArrowReaderProperties();
+  arrow_reader_props.set_batch_size(std::min<size_t>(row_group_size, 4096));
+
+  parquet::arrow::FileReaderBuilder reader_builder;
+  auto status =
+      reader_builder.OpenFile(src, /*memory_map*/ false, reader_properties);
+  if (!status.ok()) {
+    SPDLOG_ERROR("open file failed: {}", status.ToString());
+    return false;
+  }
+  reader_builder.memory_pool(pool);
+  reader_builder.properties(arrow_reader_props);
+
+  std::unique_ptr<parquet::arrow::FileReader> arrow_reader;
+  status = reader_builder.Build(&arrow_reader);
+  if (!status.ok()) {
+    SPDLOG_ERROR("build arrow reader failed: {}", status.ToString());
+    return false;
+  }
+
+  std::shared_ptr<::arrow::RecordBatchReader> rb_reader;
+  status = arrow_reader->GetRecordBatchReader(&rb_reader);
+  if (!status.ok()) {
+    SPDLOG_ERROR("get record batch reader failed: {}", status.ToString());
+    return false;
+  }
+
+  auto outfile = arrow::io::FileOutputStream::Open(dst);
+  if (!outfile.ok()) {
+    SPDLOG_ERROR("open output file failed: {}", outfile.status().ToString());
+    return false;
+  }
+  auto writer_properties = parquet::WriterProperties::Builder()
+                               .max_row_group_length(row_group_size)
+                               ->build();
+  auto writer =
+      parquet::arrow::FileWriter::Open(*rb_reader->schema(), pool,
+                                       outfile.ValueOrDie(), writer_properties);
+  if (!writer.ok()) {
+    SPDLOG_ERROR("open parquet writer failed: {}", writer.status().ToString());
+    return false;
+  }
+
+  std::shared_ptr<arrow::RecordBatch> recordBatch;
+  do {
+    status = rb_reader->ReadNext(&recordBatch);
+    if (!status.ok()) {
+      SPDLOG_ERROR("read next batch failed: {}", status.ToString());
+      return false;
+    }
+    if (recordBatch) {
+      status = writer.ValueOrDie()->WriteRecordBatch(*recordBatch);
+      if (!status.ok()) {
+        SPDLOG_ERROR("write batch failed: {}", status.ToString());
+        return false;
+      }
+    }
+  } while (recordBatch);
+
+  status = writer.ValueOrDie()->Close();
+  if (!status.ok()) {
+    SPDLOG_ERROR("close parquet writer failed: {}", status.ToString());
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+// Rewrite the Parquet base files of dataset into path with smaller row
+// groups, so that loading can spread the decoding of a single file over
+// several workers. The query and ground truth files are copied as they are.
+// Returns the location of the rewritten dataset.
+std::string
+rewrite(const DataSet *dataset,
+        const std::unordered_map<std::string, std::string> &rewrite_opt_map) {
+  assert(dataset != nullptr);
+  if (dataset->format_ != DataSetFormat::PARQUET_FORMAT) {
+    SPDLOG_ERROR("only Parquet datasets can be rewritten");
+    std::exit(1);
+  }
+
+  size_t row_group_size = default_row_group_size;
+  auto rgs = Util::getValueFromMap(rewrite_opt_map, "row_group_size");
+  if (rgs.has_value()) {
+    row_group_size = std::stoul(rgs.value());
+    if (row_group_size == 0) {
+      SPDLOG_ERROR("Illegal row_group_size value: {}", rgs.value());
+      std::exit(1);
+    }
+  }
+
+  // never overwrite the files being read
+  auto path = Util::getValueFromMap(rewrite_opt_map, "path");
+  if (!path.has_value()) {
+    SPDLOG_ERROR("rewrite needs a path to write the dataset to");
+    std::exit(1);
+  }
+  std::string location = path.value();
+  if (location.back() != '/') {
+    location.push_back('/');
+  }
+  std::error_code ec;
+  fs::create_directories(location, ec);
+  if (ec || fs::equivalent(location, dataset->location_, ec)) {
+    SPDLOG_ERROR("Illegal rewrite path: {}", path.value());
+    std::exit(1);
+  }
+
+  for (const auto &file :
+       {dataset->query_file_.first, dataset->gt_file_.first}) {
+    fs::copy_file(dataset->location_ + file, location + file,
+                  fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+      SPDLOG_ERROR("copy {} failed: {}", file, ec.message());
+      std::exit(1);
+    }
+  }
+
+  const auto &base_files = dataset->base_files_;
+  ThreadPool pool(std::min<size_t>(
+      base_files.size(), std::max(1u, std::thread::hardware_concurrency())));
+  std::atomic<size_t> failed{0};
+  pool.parallelFor(base_files.size(), [&](size_t, size_t i) {
+    const auto &file = base_files[i].first;
+    SPDLOG_INFO("rewriting {} with {} rows per row group", file,
+                row_group_size);
+    if (!rewriteParquetFile(dataset->location_ + file, location + file,
+                            row_group_size)) {
+      failed.fetch_add(1);
+    }
+  });
+  if (failed.load() > 0) {
+    SPDLOG_ERROR("failed to rewrite {} of {} base files", failed.load(),
+                 base_files.size());
+    std::exit(1);
+  }
+  return location;
+}
+
+} // namespace pgvectorbench
@@ -3,6 +3,7 @@
 #include <unordered_map>
 
 #include "dataset/dataset.h"
+#include "utils/attributes.h"
 #include "utils/client_factory.h"
 #include "utils/parser.h"
 #include "utils/util.h"
@@ -26,7 +27,8 @@ std::string generateCreateExtensionStatement(const std::string &extension) {
 
 std::string
 generateCreateTableStatement(const DataSet *dataset,
-                             const std::optional<std::string> &table_name) {
+                             const std::optional<std::string> &table_name,
+                             bool with_attributes) {
   std::ostringstream oss;
   oss << "CREATE TABLE "
       << (table_name.has_value() ? table_name.value() : dataset->name_) << "(";
@@ -39,6 +41,11 @@ generateCreateTableStatement(const DataSet *dataset,
     }
     oss << "\n    " << field.first << " " << field.second;
   }
+  if (with_attributes) {
+    for (const auto &field : AttributeGenerator::fields()) {
+      oss << ",\n    " << field.first << " " << field.second;
+    }
+  }
 
   oss << "\n);";
   std::string statement = oss.str();
@@ -88,7 +95,12 @@ void setup(const DataSet *dataset, const ClientFactory *cf,
     }
   }
 
-  auto statement = generateCreateTableStatement(dataset, table_name);
+  // scalar attribute columns of a synthetic filtered workload, they are
+  // filled by load with the same attributes option
+  bool with_attributes = parseAttributeOptions(setup_opt_map).has_value();
+
+  auto statement =
+      generateCreateTableStatement(dataset, table_name, with_attributes);
   auto ret =
       client->executeQuery(statement.c_str(), [&](PGresult *res) -> bool {
         // no need to handle result
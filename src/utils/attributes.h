@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/util.h"
+
+namespace pgvectorbench {
+
+enum class AttributeDistribution : uint8_t {
+  UNIFORM,
+  // the ith most frequent category and tag is drawn with probability
+  // ~ 1 / (i + 1), low values are the rare ones so that small selectivities
+  // can be hit
+  ZIPF,
+  CLUSTER, // categories follow a locality sensitive hash of the vector
+};
+
+enum class AttributeColumn : uint8_t {
+  CATEGORY,
+  TS,
+  TAGS,
+};
+
+constexpr size_t max_tags_per_row = 16;
+
+struct AttributeOptions {
+  AttributeDistribution distribution{AttributeDistribution::UNIFORM};
+  uint64_t seed{42};
+  uint32_t categories{1000};
+  uint32_t tags{100};
+  uint32_t tags_per_row{3};
+};
+
+// scalar attributes of one row
+struct Attributes {
+  int32_t category;
+  int64_t ts; // seconds since the unix epoch
+  std::array<int32_t, max_tags_per_row> tags;
+};
+
+// a predicate on one attribute column, rows with a value below bound match
+struct AttributeFilter {
+  AttributeColumn column;
+  int64_t bound;
+  double expected; // fraction of rows expected to match
+
+  bool matches(const Attributes &attrs, uint32_t tags_per_row) const {
+    switch (column) {
+    case AttributeColumn::CATEGORY:
+      return attrs.category < bound;
+    case AttributeColumn::TS:
+      return attrs.ts < bound;
+    case AttributeColumn::TAGS:
+      return std::any_of(attrs.tags.begin(),
+                         attrs.tags.begin() + tags_per_row,
+                         [&](int32_t tag) { return tag < bound; });
+    }
+    return false;
+  }
+
+  // the WHERE clause selecting the same rows
+  std::string clause() const;
+};
+
+/*
+ * Scalar attributes of synthetic filtered workloads: an int category, a
+ * timestamp and an array of int tags.
+ *
+ * Attributes are a pure function of the seed, the row id and its vector, so
+ * load can write them and query can evaluate predicates on them while
+ * computing the ground truth, without either reading them back.
+ */
+class AttributeGenerator {
+public:
+  static constexpr int64_t ts_start = 1704067200; // 2024-01-01 00:00:00 UTC
+  static constexpr int64_t ts_span = 366 * 86400;
+
+  AttributeGenerator(const AttributeOptions &options, size_t dim)
+      : options_(options) {
+    if (options_.distribution == AttributeDistribution::ZIPF) {
+      category_cdf_ = zipfCdf(options_.categories);
+      tag_cdf_ = zipfCdf(options_.tags);
+    }
+    if (options_.distribution == AttributeDistribution::CLUSTER) {
+      // 2^bits clusters, each owning a contiguous range of categories
+      while (cluster_bits_ < 6 &&
+             (2u << cluster_bits_) <= options_.categories) {
+        cluster_bits_++;
+      }
+      uint64_t state = options_.seed;
+      for (uint32_t b = 0; b < cluster_bits_ && dim > 1; b++) {
+        size_t i = mix(state++) % dim;
+        size_t j = (i + 1 + mix(state++) % (dim - 1)) % dim;
+        cluster_pairs_.emplace_back(i, j);
+      }
+    }
+  }
+
+  const AttributeOptions &options() const { return options_; }
+
+  // column definitions appended to the table of the dataset
+  static const std::vector<std::pair<std::string, std::string>> &fields() {
+    static const std::vector<std::pair<std::string, std::string>> fields = {
+        {"category", "int4"}, {"ts", "timestamptz"}, {"tags", "int4[]"}};
+    return fields;
+  }
+
+  template <typename DataType>
+  Attributes generate(int64_t id, const DataType *vec) const {
+    Attributes attrs;
+    uint64_t base = mix(options_.seed ^ mix(static_cast<uint64_t>(id)));
+    uint64_t h = mix(base);
+    switch (options_.distribution) {
+    case AttributeDistribution::UNIFORM:
+      attrs.category = static_cast<int32_t>(h % options_.categories);
+      break;
+    case AttributeDistribution::ZIPF:
+      attrs.category = options_.categories - 1 - sample(category_cdf_, h);
+      break;
+    case AttributeDistribution::CLUSTER: {
+      // compared as float, the type the ground truth scan sees the base
+      // vectors in, so that both agree on the category of every row
+      uint32_t cluster = 0;
+      for (const auto &[i, j] : cluster_pairs_) {
+        bool greater =
+            static_cast<float>(vec[i]) > static_cast<float>(vec[j]);
+        cluster = (cluster << 1) | (greater ? 1 : 0);
+      }
+      uint32_t per_cluster = options_.categories >> cluster_bits_;
+      attrs.category = static_cast<int32_t>(cluster * per_cluster +
+                                            h % per_cluster);
+      break;
+    }
+    }
+    attrs.ts = ts_start + static_cast<int64_t>(mix(base + 1) % ts_span);
+    for (uint32_t t = 0; t < options_.tags_per_row; t++) {
+      uint64_t ht = mix(base + 2 + t);
+      attrs.tags[t] = options_.distribution == AttributeDistribution::ZIPF
+                          ? options_.tags - 1 - sample(tag_cdf_, ht)
+                          : static_cast<int32_t>(ht % options_.tags);
+    }
+    std::sort(attrs.tags.begin(), attrs.tags.begin() + options_.tags_per_row);
+    return attrs;
+  }
+
+  // the predicate on column whose expected selectivity is closest to
+  // selectivity
+  AttributeFilter filterFor(AttributeColumn column, double selectivity) const {
+    AttributeFilter filter{column, 1, 0.0};
+    switch (column) {
+    case AttributeColumn::CATEGORY:
+      filter.expected = categoryFraction(1);
+      for (uint32_t c = 2; c <= options_.categories; c++) {
+        double fraction = categoryFraction(c);
+        if (std::fabs(fraction - selectivity) <
+            std::fabs(filter.expected - selectivity)) {
+          filter.bound = c;
+          filter.expected = fraction;
+        }
+      }
+      break;
+    case AttributeColumn::TS:
+      filter.bound = ts_start + static_cast<int64_t>(std::llround(
+                                    std::clamp(selectivity, 0.0, 1.0) *
+                                    ts_span));
+      filter.expected = static_cast<double>(filter.bound - ts_start) / ts_span;
+      break;
+    case AttributeColumn::TAGS:
+      filter.expected = tagsFraction(1);
+      for (uint32_t m = 2; m <= options_.tags; m++) {
+        double fraction = tagsFraction(m);
+        if (std::fabs(fraction - selectivity) <
+            std::fabs(filter.expected - selectivity)) {
+          filter.bound = m;
+          filter.expected = fraction;
+        }
+      }
+      break;
+    }
+    return filter;
+  }
+
+  // YYYY-MM-DD HH:MM:SS+00 as timestamptz accepts it
+  static std::string formatTimestamp(int64_t seconds) {
+    time_t t = static_cast<time_t>(seconds);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S+00", &tm);
+    return buffer;
+  }
+
+private:
+  // splitmix64
+  static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  static std::vector<double> zipfCdf(uint32_t n) {
+    std::vector<double> cdf(n);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < n; i++) {
+      sum += 1.0 / (i + 1);
+      cdf[i] = sum;
+    }
+    for (auto &c : cdf) {
+      c /= sum;
+    }
+    return cdf;
+  }
+
+  static int32_t sample(const std::vector<double> &cdf, uint64_t h) {
+    double u = (h >> 11) * 0x1.0p-53;
+    auto it = std::upper_bound(cdf.begin(), cdf.end(), u);
+    return static_cast<int32_t>(
+        std::min<size_t>(it - cdf.begin(), cdf.size() - 1));
+  }
+
+  // expected fraction of rows with a category below c
+  double categoryFraction(uint32_t c) const {
+    switch (options_.distribution) {
+    case AttributeDistribution::ZIPF:
+      return c >= options_.categories
+                 ? 1.0
+                 : 1.0 - category_cdf_[options_.categories - 1 - c];
+    case AttributeDistribution::CLUSTER: {
+      // clusters are assumed to be of about the same size
+      uint32_t used = (options_.categories >> cluster_bits_) << cluster_bits_;
+      return static_cast<double>(std::min(c, used)) / used;
+    }
+    default:
+      return static_cast<double>(std::min(c, options_.categories)) /
+             options_.categories;
+    }
+  }
+
+  // expected fraction of rows with a tag below m
+  double tagsFraction(uint32_t m) const {
+    m = std::min(m, options_.tags);
+    double p = static_cast<double>(m) / options_.tags;
+    if (options_.distribution == AttributeDistribution::ZIPF) {
+      p = m >= options_.tags ? 1.0 : 1.0 - tag_cdf_[options_.tags - 1 - m];
+    }
+    return 1.0 - std::pow(1.0 - p, options_.tags_per_row);
+  }
+
+  AttributeOptions options_;
+  std::vector<double> category_cdf_;
+  std::vector<double> tag_cdf_;
+  uint32_t cluster_bits_{0};
+  std::vector<std::pair<size_t, size_t>> cluster_pairs_;
+};
+
+inline std::string AttributeFilter::clause() const {
+  switch (column) {
+  case AttributeColumn::CATEGORY:
+    return fmt::format("category < {}", bound);
+  case AttributeColumn::TS:
+    return fmt::format("ts < '{}'", AttributeGenerator::formatTimestamp(bound));
+  case AttributeColumn::TAGS: {
+    std::string clause = "tags && '{";
+    for (int64_t tag = 0; tag < bound; tag++) {
+      clause += (tag > 0 ? "," : "") + std::to_string(tag);
+    }
+    return clause + "}'::int4[]";
+  }
+  }
+  return "";
+}
+
+// parse attributes, categories, tags, tags_per_row and attribute_seed, no
+// value if attributes is not given. load and query must be given the same
+// ones.
+inline std::optional<AttributeOptions> parseAttributeOptions(
+    const std::unordered_map<std::string, std::string> &opt_map) {
+  auto at = Util::getValueFromMap(opt_map, "attributes");
+  if (!at.has_value()) {
+    return std::nullopt;
+  }
+  AttributeOptions options;
+  std::string lowercase = at.value();
+  std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (lowercase == "zipf") {
+    options.distribution = AttributeDistribution::ZIPF;
+  } else if (lowercase == "cluster") {
+    options.distribution = AttributeDistribution::CLUSTER;
+  } else if (lowercase != "uniform") {
+    SPDLOG_ERROR("Illegal attributes: {}", at.value());
+    std::exit(1);
+  }
+
+  auto ct = Util::getValueFromMap(opt_map, "categories");
+  if (ct.has_value()) {
+    options.categories = std::stoul(ct.value());
+  }
+  auto tg = Util::getValueFromMap(opt_map, "tags");
+  if (tg.has_value()) {
+    options.tags = std::stoul(tg.value());
+  }
+  auto tp = Util::getValueFromMap(opt_map, "tags_per_row");
+  if (tp.has_value()) {
+    options.tags_per_row = std::stoul(tp.value());
+  }
+  auto as = Util::getValueFromMap(opt_map, "attribute_seed");
+  if (as.has_value()) {
+    options.seed = std::stoull(as.value());
+  }
+  if (options.categories == 0 || options.tags == 0 ||
+      options.tags_per_row == 0 || options.tags_per_row > max_tags_per_row) {
+    SPDLOG_ERROR("Illegal attribute options, categories and tags must be "
+                 "positive and tags_per_row at most {}",
+                 max_tags_per_row);
+    std::exit(1);
+  }
+  return options;
+}
+
+} // namespace pgvectorbench
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace pgvectorbench {
+
+namespace util {
+
+// Helpers for PostgreSQL's binary wire format, all values are big endian.
+
+inline char *putInt16(char *ptr, int16_t value) {
+  uint16_t n = htons(static_cast<uint16_t>(value));
+  memcpy(ptr, &n, sizeof(n));
+  return ptr + sizeof(n);
+}
+
+inline char *putInt32(char *ptr, int32_t value) {
+  uint32_t n = htonl(static_cast<uint32_t>(value));
+  memcpy(ptr, &n, sizeof(n));
+  return ptr + sizeof(n);
+}
+
+inline char *putInt64(char *ptr, int64_t value) {
+  ptr = putInt32(ptr, static_cast<int32_t>(static_cast<uint64_t>(value) >> 32));
+  return putInt32(ptr, static_cast<int32_t>(value & 0xffffffff));
+}
+
+inline char *putFloat4(char *ptr, float value) {
+  uint32_t n;
+  memcpy(&n, &value, sizeof(n));
+  return putInt32(ptr, static_cast<int32_t>(n));
+}
+
+inline int32_t getInt32(const char *ptr) {
+  uint32_t n;
+  memcpy(&n, ptr, sizeof(n));
+  return static_cast<int32_t>(ntohl(n));
+}
+
+inline int64_t getInt64(const char *ptr) {
+  uint64_t hi = static_cast<uint32_t>(getInt32(ptr));
+  uint64_t lo = static_cast<uint32_t>(getInt32(ptr + sizeof(int32_t)));
+  return static_cast<int64_t>((hi << 32) | lo);
+}
+
+// decode a binary int2/int4/int8 value of length bytes, -1 for anything else
+inline int64_t getInteger(const char *ptr, int length) {
+  switch (length) {
+  case 2: {
+    uint16_t n;
+    memcpy(&n, ptr, sizeof(n));
+    return static_cast<int16_t>(ntohs(n));
+  }
+  case 4:
+    return getInt32(ptr);
+  case 8:
+    return getInt64(ptr);
+  default:
+    return -1;
+  }
+}
+
+// decode a binary float4/float8 value of length bytes, NaN for anything else
+inline double getFloat(const char *ptr, int length) {
+  switch (length) {
+  case 4: {
+    uint32_t n = static_cast<uint32_t>(getInt32(ptr));
+    float value;
+    memcpy(&value, &n, sizeof(value));
+    return value;
+  }
+  case 8: {
+    uint64_t n = static_cast<uint64_t>(getInt64(ptr));
+    double value;
+    memcpy(&value, &n, sizeof(value));
+    return value;
+  }
+  default:
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+// size of a pgvector value in its send/recv layout
+inline size_t vectorBinarySize(size_t dim) {
+  return sizeof(int16_t) * 2 + sizeof(float) * dim;
+}
+
+// write a pgvector value as vector_send does: int16 dim, int16 unused and
+// dim float4 elements
+template <typename DataType>
+char *putVector(char *ptr, const DataType *vecs, size_t dim) {
+  ptr = putInt16(ptr, static_cast<int16_t>(dim));
+  ptr = putInt16(ptr, 0); // unused
+  for (size_t j = 0; j < dim; j++) {
+    ptr = putFloat4(ptr, static_cast<float>(vecs[j]));
+  }
+  return ptr;
+}
+
+// encode a vector into buffer, which is resized to fit and can be reused
+// between calls
+template <typename DataType>
+void encodeVector(std::string &buffer, const DataType *vecs, size_t dim) {
+  buffer.resize(vectorBinarySize(dim));
+  putVector(buffer.data(), vecs, dim);
+}
+
+} // namespace util
+} // namespace pgvectorbench
@@ -3,6 +3,7 @@
 #include <functional>
 #include <libpq-fe.h>
 #include <memory>
+#include <poll.h>
 #include <spdlog/spdlog.h>
 
 namespace pgvectorbench {
@@ -13,11 +14,17 @@ public:
 
   ~Client() { PQfinish(connection_); }
 
-  // return false if execute failed
+  // return false if execute failed, results are requested in binary when
+  // result_format is 1, which limits query to a single statement
   bool executeQuery(const char *query,
-                    std::function<bool(PGresult *)> const &resultHandler) {
+                    std::function<bool(PGresult *)> const &resultHandler,
+                    int result_format = 0) {
     assert(query != nullptr);
-    PGresult *res = PQexec(connection_, query);
+    PGresult *res = result_format == 0
+                        ? PQexec(connection_, query)
+                        : PQexecParams(connection_, query, 0, nullptr,
+                                       nullptr, nullptr, nullptr,
+                                       result_format);
     if (PQresultStatus(res) == PGRES_COMMAND_OK ||
         PQresultStatus(res) == PGRES_TUPLES_OK) {
       if (resultHandler(res)) {
@@ -34,20 +41,77 @@ public:
     return false;
   }
 
+  // create a named prepared statement on this connection, parameter types
+  // are left to the server to infer
+  bool prepare(const char *stmt_name, const char *query, int n_params) {
+    assert(query != nullptr);
+    std::unique_ptr<PGresult, decltype(&PQclear)> res(
+        PQprepare(connection_, stmt_name, query, n_params, nullptr), &PQclear);
+    if (PQresultStatus(res.get()) != PGRES_COMMAND_OK) {
+      SPDLOG_ERROR("prepare: {} failed with {}", query,
+                   PQresultErrorMessage(res.get()));
+      return false;
+    }
+    return true;
+  }
+
+  // return false if execute failed
+  bool executePrepared(const char *stmt_name, int n_params,
+                       const char *const *param_values,
+                       const int *param_lengths, const int *param_formats,
+                       std::function<bool(PGresult *)> const &resultHandler,
+                       int result_format = 0) {
+    PGresult *res =
+        PQexecPrepared(connection_, stmt_name, n_params, param_values,
+                       param_lengths, param_formats, result_format);
+    if (PQresultStatus(res) == PGRES_COMMAND_OK ||
+        PQresultStatus(res) == PGRES_TUPLES_OK) {
+      if (resultHandler(res)) {
+        SPDLOG_DEBUG("process result succeed");
+        PQclear(res);
+        return true;
+      }
+      SPDLOG_ERROR("process result failed: {}", stmt_name);
+    } else {
+      SPDLOG_ERROR("prepared statement: {} failed with {}", stmt_name,
+                   PQresultErrorMessage(res));
+    }
+    PQclear(res);
+    return false;
+  }
+
   bool copy(const char *copy_table_stmt, const char *buffer, size_t length,
             std::function<bool(PGresult *)> const &resultHandler) {
+    SPDLOG_DEBUG("copy {} bytes: {}", length, copy_table_stmt);
+
+    if (!beginCopy(copy_table_stmt)) {
+      return false;
+    }
+
+    if (!putCopyData(buffer, length)) {
+      abortCopy("put data into COPY stream failed");
+      return false;
+    }
+
+    return endCopy(resultHandler);
+  }
 
+  // start a COPY FROM STDIN stream, rows can then be pushed with putCopyData
+  // until endCopy is called
+  bool beginCopy(const char *copy_table_stmt) {
     std::unique_ptr<PGresult, decltype(&PQclear)> res(
         PQexec(connection_, copy_table_stmt), &PQclear);
 
-    SPDLOG_DEBUG("copy detail: {}, {}", copy_table_stmt, buffer);
-
     if (PQresultStatus(res.get()) != PGRES_COPY_IN) {
       SPDLOG_ERROR("unexpected COPY response: {}",
                    PQresultErrorMessage(res.get()));
       return false;
     }
 
+    return true;
+  }
+
+  bool putCopyData(const char *buffer, size_t length) {
     auto nr = PQputCopyData(connection_, buffer, length);
     if (nr != 1) {
       SPDLOG_ERROR("put data into COPY stream failed: {}",
@@ -55,21 +119,39 @@ public:
       return false;
     }
 
-    nr = PQputCopyEnd(connection_, NULL);
+    return true;
+  }
+
+  // fail the COPY stream so that the server rolls it back and the
+  // connection leaves the COPY state, nothing sent since beginCopy is kept
+  void abortCopy(const char *errormsg) {
+    if (PQputCopyEnd(connection_, errormsg) != 1) {
+      SPDLOG_ERROR("abort COPY stream failed: {}", PQerrorMessage(connection_));
+    }
+    drainResults();
+  }
+
+  // close the COPY stream, all rows sent since beginCopy are committed
+  bool endCopy(std::function<bool(PGresult *)> const &resultHandler) {
+    auto nr = PQputCopyEnd(connection_, NULL);
     if (nr != 1) {
       SPDLOG_ERROR("close data into COPY stream failed: {}",
                    PQerrorMessage(connection_));
       return false;
     }
 
-    res.reset(PQgetResult(connection_));
+    std::unique_ptr<PGresult, decltype(&PQclear)> res(
+        PQgetResult(connection_), &PQclear);
     if (PQresultStatus(res.get()) != PGRES_COMMAND_OK) {
       SPDLOG_ERROR("excute COPY command failed: {}",
                    PQresultErrorMessage(res.get()));
+      drainResults();
       return false;
     }
 
-    if (resultHandler(res.get())) {
+    bool ok = resultHandler(res.get());
+    drainResults();
+    if (ok) {
       SPDLOG_DEBUG("process result succeed");
       return true;
     }
@@ -78,7 +160,143 @@ public:
     return false;
   }
 
+  // Pipeline mode (libpq >= 14) keeps several queries in flight on one
+  // connection. The connection is switched to non-blocking so that sending
+  // can never deadlock against the server writing results we have not read.
+  bool enterPipelineMode() {
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQsetnonblocking(connection_, 1) != 0 ||
+        PQenterPipelineMode(connection_) != 1) {
+      SPDLOG_ERROR("enter pipeline mode failed: {}",
+                   PQerrorMessage(connection_));
+      return false;
+    }
+    return true;
+#else
+    SPDLOG_ERROR("pipeline mode requires libpq 14 or later");
+    return false;
+#endif
+  }
+
+  bool exitPipelineMode() {
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQexitPipelineMode(connection_) != 1) {
+      SPDLOG_ERROR("exit pipeline mode failed: {}",
+                   PQerrorMessage(connection_));
+      return false;
+    }
+    return PQsetnonblocking(connection_, 0) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // queue a query followed by its own sync point, so a failing query does not
+  // abort the ones behind it. Results come back in send order through
+  // getPipelineResult.
+  bool sendPipelineQuery(const char *query, int result_format = 0) {
+    assert(query != nullptr);
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQsendQueryParams(connection_, query, 0, nullptr, nullptr, nullptr,
+                          nullptr, result_format) != 1 ||
+        PQpipelineSync(connection_) != 1) {
+      SPDLOG_ERROR("query: {} send failed with {}", query,
+                   PQerrorMessage(connection_));
+      return false;
+    }
+    return PQflush(connection_) != -1;
+#else
+    return false;
+#endif
+  }
+
+  // same as sendPipelineQuery but for a statement created with prepare
+  bool sendPipelinePrepared(const char *stmt_name, int n_params,
+                            const char *const *param_values,
+                            const int *param_lengths,
+                            const int *param_formats, int result_format = 0) {
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQsendQueryPrepared(connection_, stmt_name, n_params, param_values,
+                            param_lengths, param_formats, result_format) != 1 ||
+        PQpipelineSync(connection_) != 1) {
+      SPDLOG_ERROR("prepared statement: {} send failed with {}", stmt_name,
+                   PQerrorMessage(connection_));
+      return false;
+    }
+    return PQflush(connection_) != -1;
+#else
+    return false;
+#endif
+  }
+
+  // wait for the result of the oldest query in flight and consume its sync
+  bool getPipelineResult(std::function<bool(PGresult *)> const &resultHandler) {
+#ifdef LIBPQ_HAS_PIPELINING
+    std::unique_ptr<PGresult, decltype(&PQclear)> res(waitResult(), &PQclear);
+    bool ok = false;
+    if (PQresultStatus(res.get()) == PGRES_COMMAND_OK ||
+        PQresultStatus(res.get()) == PGRES_TUPLES_OK) {
+      ok = resultHandler(res.get());
+      if (!ok) {
+        SPDLOG_ERROR("process pipeline result failed");
+      }
+    } else {
+      SPDLOG_ERROR("pipeline query failed with {}",
+                   res ? PQresultErrorMessage(res.get())
+                       : PQerrorMessage(connection_));
+    }
+
+    if (res) {
+      // NULL marks the end of this query's results, then comes the sync
+      res.reset(waitResult());
+      assert(res == nullptr);
+      res.reset(waitResult());
+    }
+    if (PQresultStatus(res.get()) != PGRES_PIPELINE_SYNC) {
+      SPDLOG_ERROR("unexpected pipeline sync response: {}",
+                   PQerrorMessage(connection_));
+      return false;
+    }
+    return ok;
+#else
+    return false;
+#endif
+  }
+
 private:
+  // flush pending output and block on the socket until the next result can be
+  // returned by PQgetResult without blocking
+  PGresult *waitResult() {
+    while (true) {
+      int flushed = PQflush(connection_);
+      if (flushed == -1) {
+        return nullptr;
+      }
+      if (!PQisBusy(connection_)) {
+        break;
+      }
+      struct pollfd pfd;
+      pfd.fd = PQsocket(connection_);
+      pfd.events = POLLIN | (flushed == 1 ? POLLOUT : 0);
+      pfd.revents = 0;
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+        return nullptr;
+      }
+      if ((pfd.revents & POLLIN) && PQconsumeInput(connection_) != 1) {
+        return nullptr;
+      }
+    }
+    return PQgetResult(connection_);
+  }
+
+  // consume the trailing NULL result so the connection is ready for the next
+  // command
+  void drainResults() {
+    while (PGresult *res = PQgetResult(connection_)) {
+      PQclear(res);
+    }
+  }
+
   PGconn *connection_;
 };
 
@@ -184,6 +402,16 @@ public:
     return std::make_unique<Client>(conn);
   }
 
+  // application_name of the connections, tells their backends apart
+  std::string applicationName() const {
+    for (size_t i = 0; i < keywords_holder.size(); i++) {
+      if (keywords_holder[i] == "application_name") {
+        return values_holder[i];
+      }
+    }
+    return "";
+  }
+
   bool pingServer() {
     const auto result =
         PQpingParams(keywords_.data(), values_.data(), 1 /* expand_dbname */);
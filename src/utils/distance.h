@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PGVECTORBENCH_X86_SIMD 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PGVECTORBENCH_NEON_SIMD 1
+#endif
+
+namespace pgvectorbench {
+
+namespace util {
+
+/*
+ * Distance kernels over float vectors, the widest instruction set supported
+ * by the running CPU is picked once at runtime, so the binary does not need
+ * to be built with -march=native.
+ */
+using DistanceKernel = float (*)(const float *a, const float *b, size_t dim);
+
+struct DistanceKernels {
+  DistanceKernel l2_sqr;        // squared Euclidean distance
+  DistanceKernel inner_product; // dot product
+  DistanceKernel l1;            // Manhattan distance
+  const char *isa;              // name of the instruction set in use
+};
+
+namespace detail {
+
+inline float l2SqrScalar(const float *a, const float *b, size_t dim) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < dim; i++) {
+    float diff = a[i] - b[i];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+inline float innerProductScalar(const float *a, const float *b, size_t dim) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < dim; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+inline float l1Scalar(const float *a, const float *b, size_t dim) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < dim; i++) {
+    sum += std::fabs(a[i] - b[i]);
+  }
+  return sum;
+}
+
+#ifdef PGVECTORBENCH_X86_SIMD
+__attribute__((target("avx2,fma"))) inline float hsumAvx2(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  lo = _mm_hadd_ps(lo, lo);
+  lo = _mm_hadd_ps(lo, lo);
+  return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma"))) inline float
+l2SqrAvx2(const float *a, const float *b, size_t dim) {
+  // two accumulators hide the latency of the fused multiply add
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    __m256 d1 =
+        _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+    sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+    sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+  }
+  for (; i + 8 <= dim; i += 8) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+  }
+  float sum = hsumAvx2(_mm256_add_ps(sum0, sum1));
+  return sum + l2SqrScalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx2,fma"))) inline float
+innerProductAvx2(const float *a, const float *b, size_t dim) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    sum0 =
+        _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+                           _mm256_loadu_ps(b + i + 8), sum1);
+  }
+  for (; i + 8 <= dim; i += 8) {
+    sum0 =
+        _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+  }
+  float sum = hsumAvx2(_mm256_add_ps(sum0, sum1));
+  return sum + innerProductScalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx2,fma"))) inline float
+l1Avx2(const float *a, const float *b, size_t dim) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    sum = _mm256_add_ps(sum, _mm256_andnot_ps(sign, d));
+  }
+  return hsumAvx2(sum) + l1Scalar(a + i, b + i, dim - i);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline float
+hsumAvx512(__m512 v) {
+  // spill and fold the two 256 bit halves, the extract intrinsics trip
+  // -Wuninitialized on some GCC versions
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, v);
+  return hsumAvx2(
+      _mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline float
+l2SqrAvx512(const float *a, const float *b, size_t dim) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 32 <= dim; i += 32) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16),
+                              _mm512_loadu_ps(b + i + 16));
+    sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+    sum1 = _mm512_fmadd_ps(d1, d1, sum1);
+  }
+  if (i + 16 <= dim) {
+    __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+    i += 16;
+  }
+  // masked loads take care of the tail
+  if (i < dim) {
+    __mmask16 mask = static_cast<__mmask16>((1u << (dim - i)) - 1);
+    __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                              _mm512_maskz_loadu_ps(mask, b + i));
+    sum1 = _mm512_fmadd_ps(d0, d0, sum1);
+  }
+  return hsumAvx512(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline float
+innerProductAvx512(const float *a, const float *b, size_t dim) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 32 <= dim; i += 32) {
+    sum0 =
+        _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16),
+                           _mm512_loadu_ps(b + i + 16), sum1);
+  }
+  if (i + 16 <= dim) {
+    sum0 =
+        _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+    i += 16;
+  }
+  if (i < dim) {
+    __mmask16 mask = static_cast<__mmask16>((1u << (dim - i)) - 1);
+    sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                           _mm512_maskz_loadu_ps(mask, b + i), sum1);
+  }
+  return hsumAvx512(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline float
+l1Avx512(const float *a, const float *b, size_t dim) {
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= dim; i += 16) {
+    __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    sum = _mm512_add_ps(sum, _mm512_abs_ps(d));
+  }
+  if (i < dim) {
+    __mmask16 mask = static_cast<__mmask16>((1u << (dim - i)) - 1);
+    __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                             _mm512_maskz_loadu_ps(mask, b + i));
+    sum = _mm512_add_ps(sum, _mm512_abs_ps(d));
+  }
+  return hsumAvx512(sum);
+}
+#endif
+
+#ifdef PGVECTORBENCH_NEON_SIMD
+inline float l2SqrNeon(const float *a, const float *b, size_t dim) {
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+    float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    sum0 = vfmaq_f32(sum0, d0, d0);
+    sum1 = vfmaq_f32(sum1, d1, d1);
+  }
+  float sum = vaddvq_f32(vaddq_f32(sum0, sum1));
+  return sum + l2SqrScalar(a + i, b + i, dim - i);
+}
+
+inline float innerProductNeon(const float *a, const float *b, size_t dim) {
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 8 <= dim; i += 8) {
+    sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+    sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  float sum = vaddvq_f32(vaddq_f32(sum0, sum1));
+  return sum + innerProductScalar(a + i, b + i, dim - i);
+}
+
+inline float l1Neon(const float *a, const float *b, size_t dim) {
+  float32x4_t sum = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 4 <= dim; i += 4) {
+    sum = vaddq_f32(sum, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  }
+  return vaddvq_f32(sum) + l1Scalar(a + i, b + i, dim - i);
+}
+#endif
+
+inline DistanceKernels selectDistanceKernels() {
+#ifdef PGVECTORBENCH_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {l2SqrAvx512, innerProductAvx512, l1Avx512, "avx512"};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {l2SqrAvx2, innerProductAvx2, l1Avx2, "avx2"};
+  }
+#endif
+#ifdef PGVECTORBENCH_NEON_SIMD
+  return {l2SqrNeon, innerProductNeon, l1Neon, "neon"};
+#endif
+  return {l2SqrScalar, innerProductScalar, l1Scalar, "scalar"};
+}
+
+} // namespace detail
+
+inline const DistanceKernels &distanceKernels() {
+  static const DistanceKernels kernels = detail::selectDistanceKernels();
+  return kernels;
+}
+
+} // namespace util
+
+} // namespace pgvectorbench
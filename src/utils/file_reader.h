@@ -1,21 +1,58 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/io_uring.h"
+#include "utils/util.h"
 
 namespace pgvectorbench {
 
 namespace util {
 
+enum class ReadMode : uint8_t {
+  PREAD, // copy into caller provided buffers through the page cache
+  MMAP,  // map the whole file and hand out pointers into the mapping
+  URING, // like PREAD with the reads split and queued to io_uring
+};
+
+struct ReadOptions {
+  ReadMode mode{ReadMode::PREAD};
+  bool populate{false}; // MAP_POPULATE, prefault the whole mapping on open
+  bool hugepage{false}; // MADV_HUGEPAGE, if the filesystem supports it
+  bool prefetch{true};  // read the next block ahead while one is converted
+  bool direct{false};   // O_DIRECT, keep reads out of the page cache
+  unsigned queue_depth{32}; // reads in flight per thread in uring mode
+};
+
+// a read buffer aligned for O_DIRECT, see FileReader::alignedBuffer
+using AlignedBuffer = std::unique_ptr<char, decltype(&free)>;
+
 class FileReader {
 public:
-  FileReader(const std::string &filename) : filename_(filename) {}
+  FileReader(const std::string &filename, ReadOptions options = ReadOptions())
+      : filename_(filename), options_(options) {}
 
   ~FileReader() {
+    if (addr_ != nullptr) {
+      munmap(addr_, filesize_);
+    }
     if (fd_ != -1) {
       close(fd_);
     }
@@ -23,9 +60,27 @@ public:
 
   void open() {
     assert(fd_ == -1);
+    int flags = O_RDONLY;
+#ifdef O_DIRECT
+    if (options_.direct && options_.mode != ReadMode::MMAP) {
+      flags |= O_DIRECT;
+    }
+#endif
     do {
-      fd_ = ::open(filename_.c_str(), O_RDONLY);
+      fd_ = ::open(filename_.c_str(), flags);
     } while (fd_ < 0 && errno == EINTR);
+#ifdef O_DIRECT
+    if (fd_ < 0 && errno == EINVAL && (flags & O_DIRECT)) {
+      SPDLOG_WARN("{} does not support O_DIRECT, reading through the page "
+                  "cache",
+                  filename_);
+      flags &= ~O_DIRECT;
+      do {
+        fd_ = ::open(filename_.c_str(), flags);
+      } while (fd_ < 0 && errno == EINTR);
+    }
+    direct_ = flags & O_DIRECT;
+#endif
     if (fd_ < 0) {
       throw std::runtime_error("Error opening file: " + filename_);
     }
@@ -38,6 +93,16 @@ public:
     }
 
     filesize_ = fileInfo.st_size;
+
+    if (options_.mode == ReadMode::MMAP && filesize_ > 0) {
+      map();
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (!mapped() && !direct_) {
+      // a larger readahead window, base files are consumed front to back
+      posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
   }
 
   size_t filesize() {
@@ -45,12 +110,167 @@ public:
     return filesize_;
   }
 
-  void read(char *buffer, size_t n, size_t offset) {
+  bool mapped() const { return addr_ != nullptr; }
+
+  // Return a pointer to n bytes at offset without copying, only valid in
+  // mmap mode. The range is advised as WILLNEED so the kernel reads it ahead
+  // in one go instead of faulting it in page by page.
+  const char *view(size_t offset, size_t n) {
+    assert(mapped());
+    assert(offset + n <= filesize_);
+    static const size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t aligned = offset & ~(pagesize - 1);
+    madvise(static_cast<char *>(addr_) + aligned, n + (offset - aligned),
+            MADV_WILLNEED);
+    return static_cast<const char *>(addr_) + offset;
+  }
+
+  // Ask the kernel to start reading n bytes at offset in the background, a
+  // later read or view of the range then finds it in the page cache.
+  void prefetch(size_t offset, size_t n) {
+    assert(offset + n <= filesize_);
+    static const size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t aligned = offset & ~(pagesize - 1);
+    if (mapped()) {
+      madvise(static_cast<char *>(addr_) + aligned, n + (offset - aligned),
+              MADV_WILLNEED);
+      return;
+    }
+    if (direct_) {
+      return; // nothing to read ahead into
+    }
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd_, static_cast<off_t>(aligned),
+                  static_cast<off_t>(n + (offset - aligned)),
+                  POSIX_FADV_WILLNEED);
+#endif
+  }
+
+  // Read n bytes at offset into buffer and return where they start, which
+  // is buffer itself unless the file is opened with O_DIRECT. O_DIRECT wants
+  // aligned offsets and lengths, so the aligned range around the request is
+  // read instead, buffer must then come from alignedBuffer(n).
+  const char *read(char *buffer, size_t n, size_t offset) {
+    const char *data = readAsync(buffer, n, offset);
+    wait();
+    return data;
+  }
+
+  // Start a read like read does and return where the bytes will start. In
+  // uring mode the reads are only submitted and buffer must not be touched
+  // before wait() on the same thread, in the other modes the read completes
+  // right away. A thread has at most one read in flight.
+  const char *readAsync(char *buffer, size_t n, size_t offset) {
+    if (mapped()) {
+      assert(offset + n <= filesize_);
+      memcpy(buffer, static_cast<const char *>(addr_) + offset, n);
+      return buffer;
+    }
+    if (!direct_) {
+      startRange(buffer, n, offset);
+      return buffer;
+    }
+
+    assert(reinterpret_cast<uintptr_t>(buffer) % direct_alignment == 0);
+    size_t begin = offset & ~(direct_alignment - 1);
+    size_t end = (offset + n + direct_alignment - 1) & ~(direct_alignment - 1);
+    startRange(buffer, end - begin, begin);
+    return buffer + (offset - begin);
+  }
+
+  // complete the read this thread started with readAsync, if any
+  void wait() {
+    PendingRead &pending = pendingRead();
+    if (pending.reader != this) {
+      return;
+    }
+    pending.reader = nullptr;
+    int ret = pending.ring->finish();
+    if (ret == 0) {
+      return;
+    }
+    if (ret != -EINVAL && ret != -EOPNOTSUPP) {
+      throw std::runtime_error(std::string("Error happened when read: ") +
+                               strerror(-ret));
+    }
+    disableUring();
+    preadRange(pending.buffer, pending.n, pending.offset);
+  }
+
+  // a buffer that read can place n bytes at any offset in, in any mode
+  static AlignedBuffer alignedBuffer(size_t n) {
+    size_t size = ((n + direct_alignment - 1) & ~(direct_alignment - 1)) +
+                  direct_alignment;
+    AlignedBuffer buffer(
+        static_cast<char *>(aligned_alloc(direct_alignment, size)), &free);
+    if (buffer == nullptr) {
+      throw std::bad_alloc();
+    }
+    return buffer;
+  }
+
+private:
+  static constexpr size_t direct_alignment = 4096;
+  static constexpr size_t uring_chunk_size = 128 * 1024;
+
+  // a read submitted to the ring of a thread and not yet waited for
+  struct PendingRead {
+    FileReader *reader{nullptr};
+    IoUring *ring{nullptr};
+    char *buffer{nullptr};
+    size_t n{0};
+    size_t offset{0};
+  };
+
+  static PendingRead &pendingRead() {
+    thread_local PendingRead pending;
+    return pending;
+  }
+
+  // start reading n bytes at offset, a range running past the end of the
+  // file stops there
+  void startRange(char *buffer, size_t n, size_t offset) {
+    assert(pendingRead().reader == nullptr);
+    if (options_.mode == ReadMode::URING && uring_usable_.load()) {
+      IoUring *ring = threadRing(options_.queue_depth);
+      if (ring != nullptr) {
+        std::vector<ReadRequest> requests;
+        for (size_t done = 0; done < n; done += uring_chunk_size) {
+          requests.push_back({buffer + done,
+                              std::min(uring_chunk_size, n - done),
+                              offset + done});
+        }
+        int ret = ring->start(fd_, std::move(requests), filesize_);
+        if (ret == 0) {
+          pendingRead() = {this, ring, buffer, n, offset};
+          return;
+        }
+        if (ret != -EINVAL && ret != -EOPNOTSUPP) {
+          throw std::runtime_error(std::string("Error happened when read: ") +
+                                   strerror(-ret));
+        }
+      }
+      disableUring();
+    }
+    preadRange(buffer, n, offset);
+  }
+
+  // no io_uring, or no IORING_OP_READ before linux 5.6
+  void disableUring() {
+    if (uring_usable_.exchange(false)) {
+      SPDLOG_WARN("io_uring is not available, falling back to pread");
+    }
+  }
+
+  void preadRange(char *buffer, size_t n, size_t offset) {
     size_t left = n;
     ssize_t r = -1;
     char *ptr = buffer;
     while (left > 0) {
       r = pread(fd_, ptr, left, static_cast<off_t>(offset));
+      if (r == 0 && offset >= filesize_) {
+        break;
+      }
       if (r <= 0) {
         if (r == -1 && errno == EINTR) {
           continue;
@@ -63,11 +283,100 @@ public:
     }
   }
 
-private:
+  // one ring per thread, nullptr if io_uring can not be set up
+  static IoUring *threadRing(unsigned queue_depth) {
+    thread_local std::unique_ptr<IoUring> ring;
+    thread_local bool tried = false;
+    if (!tried) {
+      tried = true;
+      ring = std::make_unique<IoUring>(queue_depth);
+      if (!ring->valid()) {
+        ring.reset();
+      }
+    }
+    return ring.get();
+  }
+
+  void map() {
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (options_.populate) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    void *addr = mmap(nullptr, filesize_, PROT_READ, flags, fd_, 0);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("Error mapping file: " + filename_);
+    }
+    addr_ = addr;
+
+    // base files are consumed front to back
+    madvise(addr_, filesize_, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (options_.hugepage) {
+      madvise(addr_, filesize_, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
   std::string filename_;
+  ReadOptions options_;
   int fd_{-1};
   size_t filesize_{0};
+  void *addr_{nullptr};
+  bool direct_{false};
+  std::atomic<bool> uring_usable_{true};
 };
 
+// parse io, mmap_populate, mmap_hugepage, prefetch, direct and queue_depth,
+// how the VECS base files are read by load and by the ground truth scans of
+// query
+inline ReadOptions parseReadOptions(
+    const std::unordered_map<std::string, std::string> &opt_map) {
+  ReadOptions options;
+  auto io = Util::getValueFromMap(opt_map, "io");
+  if (io.has_value()) {
+    std::string lowercase = io.value();
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (lowercase == "mmap") {
+      options.mode = ReadMode::MMAP;
+    } else if (lowercase == "uring") {
+      options.mode = ReadMode::URING;
+    } else if (lowercase != "pread") {
+      SPDLOG_ERROR("Illegal io mode: {}", io.value());
+      std::exit(1);
+    }
+  }
+  auto mp = Util::getValueFromMap(opt_map, "mmap_populate");
+  if (mp.has_value()) {
+    options.populate = Util::isYes(mp.value());
+  }
+  auto mh = Util::getValueFromMap(opt_map, "mmap_hugepage");
+  if (mh.has_value()) {
+    options.hugepage = Util::isYes(mh.value());
+  }
+  auto pf = Util::getValueFromMap(opt_map, "prefetch");
+  if (pf.has_value()) {
+    options.prefetch = Util::isYes(pf.value());
+  }
+  auto di = Util::getValueFromMap(opt_map, "direct");
+  if (di.has_value()) {
+    options.direct = Util::isYes(di.value());
+  }
+  auto qd = Util::getValueFromMap(opt_map, "queue_depth");
+  if (qd.has_value()) {
+    options.queue_depth = std::stoul(qd.value());
+    if (options.queue_depth == 0) {
+      SPDLOG_ERROR("Illegal queue_depth value: {}", qd.value());
+      std::exit(1);
+    }
+  }
+  if (options.direct && options.prefetch && options.mode == ReadMode::PREAD) {
+    SPDLOG_WARN("direct=yes reads blocks ahead only with io=uring");
+  }
+  return options;
+}
+
 } // namespace util
 } // namespace pgvectorbench
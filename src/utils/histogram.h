@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace pgvectorbench {
+
+/*
+ * A High Dynamic Range histogram, see http://hdrhistogram.org/
+ *
+ * Values in [1, highest] are recorded with a fixed number of significant
+ * decimal digits, so memory only depends on the range and the precision, not
+ * on the number of samples. Histograms with the same configuration can be
+ * merged, which lets every thread record into its own instance.
+ *
+ * best/worst/average/operator() mirror the Percentile API, results are
+ * divided by unit, e.g. record nanoseconds and report microseconds with a
+ * unit of 1000.
+ */
+class HdrHistogram {
+public:
+  HdrHistogram(uint64_t highest, int significant_figures, double unit = 1.0)
+      : highest_(highest), significant_figures_(significant_figures),
+        unit_(unit) {
+    if (significant_figures < 1 || significant_figures > 5) {
+      throw std::runtime_error("significant figures should be within [1, 5]!");
+    }
+    assert(highest >= 2);
+
+    // smallest power of two sub bucket count that covers the precision
+    uint64_t largest_single_unit = 2;
+    for (int i = 0; i < significant_figures; i++) {
+      largest_single_unit *= 10;
+    }
+    int sub_bucket_count_magnitude =
+        static_cast<int>(std::ceil(std::log2(largest_single_unit)));
+    sub_bucket_half_count_magnitude_ = sub_bucket_count_magnitude - 1;
+    sub_bucket_count_ = uint64_t{1} << sub_bucket_count_magnitude;
+    sub_bucket_half_count_ = sub_bucket_count_ / 2;
+    sub_bucket_mask_ = sub_bucket_count_ - 1;
+
+    // each bucket doubles the covered range
+    uint64_t smallest_untrackable = sub_bucket_count_;
+    bucket_count_ = 1;
+    while (smallest_untrackable <= highest) {
+      if (smallest_untrackable > std::numeric_limits<uint64_t>::max() / 2) {
+        bucket_count_++;
+        break;
+      }
+      smallest_untrackable <<= 1;
+      bucket_count_++;
+    }
+
+    counts_.assign((bucket_count_ + 1) * sub_bucket_half_count_, 0);
+  }
+
+  // values out of range are clamped to [1, highest]
+  void record(uint64_t value) {
+    value = std::clamp<uint64_t>(value, 1, highest_);
+    counts_[countsIndex(value)]++;
+    total_++;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void merge(const HdrHistogram &other) {
+    if (other.counts_.size() != counts_.size()) {
+      throw std::runtime_error("merge histograms of different layout!");
+    }
+    for (size_t i = 0; i < counts_.size(); i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  void reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = 0;
+    sum_ = 0;
+    min_ = std::numeric_limits<uint64_t>::max();
+    max_ = 0;
+  }
+
+  uint64_t count() const { return total_; }
+
+  bool empty() const { return total_ == 0; }
+
+  uint64_t highest() const { return highest_; }
+
+  int significantFigures() const { return significant_figures_; }
+
+  // smallest recorded value in recording units
+  uint64_t min() const { return empty() ? 0 : min_; }
+
+  // largest recorded value in recording units
+  uint64_t max() const { return max_; }
+
+  // recorded value at percentage in recording units, reported as the highest
+  // value equivalent to the bucket it falls in
+  uint64_t valueAt(double percentage) const {
+    if (percentage < 0.0 || percentage > 100.0) {
+      throw std::runtime_error("percentage should be within [0.0, 100.0]!");
+    }
+    if (empty()) {
+      throw std::runtime_error("no data to profile!");
+    }
+    uint64_t target = std::min(
+        total_, std::max<uint64_t>(
+                    1, (uint64_t)std::ceil(total_ * percentage / 100.0)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen >= target) {
+        return std::min(highestEquivalentValue(valueFromIndex(i)), max_);
+      }
+    }
+    return max_;
+  }
+
+  double best() const {
+    if (empty()) {
+      throw std::runtime_error("no data to profile!");
+    }
+    return min_ / unit_;
+  }
+
+  double worst() const {
+    if (empty()) {
+      throw std::runtime_error("no data to profile!");
+    }
+    return max_ / unit_;
+  }
+
+  double average() const {
+    if (empty()) {
+      throw std::runtime_error("no data to calculate average!");
+    }
+    return static_cast<double>(sum_) / total_ / unit_;
+  }
+
+  double operator()(double percentage) const {
+    return valueAt(percentage) / unit_;
+  }
+
+private:
+  size_t countsIndex(uint64_t value) const {
+    int bucket_index = bucketIndex(value);
+    uint64_t sub_bucket_index = value >> bucket_index;
+    // the first bucket uses all sub buckets, the following ones only the
+    // upper half since the lower half overlaps the previous bucket
+    return ((bucket_index + 1) << sub_bucket_half_count_magnitude_) +
+           (sub_bucket_index - sub_bucket_half_count_);
+  }
+
+  int bucketIndex(uint64_t value) const {
+    int pow2ceiling = 64 - __builtin_clzll(value | sub_bucket_mask_);
+    return pow2ceiling - (sub_bucket_half_count_magnitude_ + 1);
+  }
+
+  uint64_t valueFromIndex(size_t index) const {
+    int bucket_index =
+        static_cast<int>(index >> sub_bucket_half_count_magnitude_) - 1;
+    uint64_t sub_bucket_index =
+        (index & (sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+    if (bucket_index < 0) {
+      sub_bucket_index -= sub_bucket_half_count_;
+      bucket_index = 0;
+    }
+    return sub_bucket_index << bucket_index;
+  }
+
+  uint64_t highestEquivalentValue(uint64_t value) const {
+    int bucket_index = bucketIndex(value);
+    uint64_t sub_bucket_index = value >> bucket_index;
+    uint64_t lowest = sub_bucket_index << bucket_index;
+    uint64_t range = uint64_t{1}
+                     << (bucket_index +
+                         (sub_bucket_index >= sub_bucket_count_ ? 1 : 0));
+    return lowest + range - 1;
+  }
+
+  uint64_t highest_;
+  int significant_figures_;
+  double unit_;
+
+  int sub_bucket_half_count_magnitude_;
+  uint64_t sub_bucket_count_;
+  uint64_t sub_bucket_half_count_;
+  uint64_t sub_bucket_mask_;
+  size_t bucket_count_;
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_{0};
+  uint64_t sum_{0};
+  uint64_t min_{std::numeric_limits<uint64_t>::max()};
+  uint64_t max_{0};
+};
+
+// One histogram per recording thread, aligned so that the bookkeeping fields
+// of neighbouring threads never share a cache line.
+struct alignas(64) ThreadHistogram {
+  ThreadHistogram(uint64_t highest, int significant_figures, double unit = 1.0)
+      : histogram(highest, significant_figures, unit) {}
+
+  HdrHistogram histogram;
+};
+
+/*
+ * Records values of one writer thread into interval histograms that a reader
+ * thread can sample at any time without making the writer take a lock.
+ *
+ * Two histograms alternate between being written and being drained. The
+ * writer bumps seq_ to odd before touching the active histogram and back to
+ * even afterwards, so once the reader has flipped active_ it only has to wait
+ * for an odd seq_ it observed to move on before the retired histogram is
+ * quiescent.
+ */
+class alignas(64) IntervalRecorder {
+public:
+  IntervalRecorder(uint64_t highest, int significant_figures, double unit = 1.0)
+      : histograms_{HdrHistogram(highest, significant_figures, unit),
+                    HdrHistogram(highest, significant_figures, unit)} {}
+
+  IntervalRecorder(const IntervalRecorder &) = delete;
+  IntervalRecorder &operator=(const IntervalRecorder &) = delete;
+
+  // writer side
+  void record(uint64_t value) {
+    seq_.fetch_add(1);
+    histograms_[active_.load()].record(value);
+    seq_.fetch_add(1);
+  }
+
+  void recordError() { errors_.fetch_add(1, std::memory_order_relaxed); }
+
+  // reader side, move everything recorded since the previous call into out
+  void drainInto(HdrHistogram &out) {
+    int retired = active_.load();
+    active_.store(retired ^ 1);
+    uint64_t seq = seq_.load();
+    if (seq & 1) {
+      while (seq_.load() == seq) {
+        std::this_thread::yield();
+      }
+    }
+    out.merge(histograms_[retired]);
+    histograms_[retired].reset();
+  }
+
+  // total number of errors recorded so far
+  uint64_t errors() const { return errors_.load(std::memory_order_relaxed); }
+
+private:
+  HdrHistogram histograms_[2];
+  std::atomic<int> active_{0};
+  std::atomic<uint64_t> seq_{0};
+  std::atomic<uint64_t> errors_{0};
+};
+
+} // namespace pgvectorbench
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/histogram.h"
+#include "utils/wait_sampler.h"
+
+namespace pgvectorbench {
+
+enum class ReportFormat : uint8_t {
+  CSV,  // one header line followed by comma separated rows
+  JSON, // one JSON object per line
+};
+
+/*
+ * Reports throughput, latency percentiles and errors of every interval while
+ * a phase is running.
+ *
+ * Each worker thread records into its own IntervalRecorder, a background
+ * thread drains all of them once per interval, logs one line and optionally
+ * appends a row to the report file. With a wait event sampler the states and
+ * wait events sampled in the interval are reported along.
+ */
+class IntervalReporter {
+public:
+  IntervalReporter(std::chrono::milliseconds interval, size_t thread_num,
+                   uint64_t highest, int significant_figures, double unit,
+                   const std::optional<std::string> &report_file,
+                   ReportFormat format, WaitEventSampler *waits = nullptr)
+      : interval_(interval), format_(format), waits_(waits),
+        window_(highest, significant_figures, unit) {
+    recorders_.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; i++) {
+      recorders_.push_back(std::make_unique<IntervalRecorder>(
+          highest, significant_figures, unit));
+    }
+    if (report_file.has_value()) {
+      out_.open(report_file.value(), std::ios::out | std::ios::trunc);
+      if (!out_) {
+        throw std::runtime_error("failed to open report file: " +
+                                 report_file.value());
+      }
+      if (format_ == ReportFormat::CSV) {
+        out_ << "elapsed_s,count,qps,p50_us,p99_us,p999_us,errors"
+             << (waits_ != nullptr ? ",states,waits\n" : "\n");
+      }
+    }
+  }
+
+  ~IntervalReporter() { stop(); }
+
+  IntervalRecorder &recorder(size_t thread_id) {
+    return *recorders_[thread_id];
+  }
+
+  void start(std::chrono::high_resolution_clock::time_point begin) {
+    begin_ = begin;
+    last_ = begin;
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  // stop the reporter thread, whatever was recorded since the last tick is
+  // reported as a final, shorter interval
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    report(std::chrono::high_resolution_clock::now(), true);
+    out_.flush();
+  }
+
+private:
+  void run() {
+    auto next = begin_ + interval_;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_until(lock, next, [this] { return stopped_; })) {
+      lock.unlock();
+      report(next);
+      lock.lock();
+      next += interval_;
+    }
+  }
+
+  void report(std::chrono::high_resolution_clock::time_point now,
+              bool last = false) {
+    window_.reset();
+    uint64_t errors = 0;
+    for (auto &recorder : recorders_) {
+      recorder->drainInto(window_);
+      errors += recorder->errors();
+    }
+    uint64_t window_errors = errors - errors_;
+    errors_ = errors;
+    WaitCounts waits;
+    if (waits_ != nullptr) {
+      waits = waits_->drainWindow();
+    }
+
+    double seconds = std::chrono::duration<double>(now - last_).count();
+    double elapsed = std::chrono::duration<double>(now - begin_).count();
+    last_ = now;
+    if (seconds <= 0.0 || (last && window_.empty() && window_errors == 0)) {
+      return;
+    }
+
+    double qps = window_.count() / seconds;
+    double p50 = window_.empty() ? 0.0 : window_(50.0);
+    double p99 = window_.empty() ? 0.0 : window_(99.0);
+    double p999 = window_.empty() ? 0.0 : window_(99.9);
+    SPDLOG_INFO("[{:.1f}s] qps: {:.1f}, p50(us): {}, p99(us): {}, p999(us): "
+                "{}, errors: {}",
+                elapsed, qps, p50, p99, p999, window_errors);
+    if (waits_ != nullptr) {
+      SPDLOG_INFO("[{:.1f}s] waits: {}", elapsed, WaitCounts::top(waits.waits));
+    }
+
+    if (!out_.is_open()) {
+      return;
+    }
+    if (format_ == ReportFormat::CSV) {
+      out_ << fmt::format("{:.3f},{},{:.1f},{},{},{},{}", elapsed,
+                          window_.count(), qps, p50, p99, p999, window_errors);
+      if (waits_ != nullptr) {
+        out_ << "," << WaitCounts::csv(waits.states) << ","
+             << WaitCounts::csv(waits.waits);
+      }
+      out_ << "\n";
+    } else {
+      out_ << fmt::format(
+          "{{\"elapsed_s\":{:.3f},\"count\":{},\"qps\":{:.1f},\"p50_us\":{},"
+          "\"p99_us\":{},\"p999_us\":{},\"errors\":{}",
+          elapsed, window_.count(), qps, p50, p99, p999, window_errors);
+      if (waits_ != nullptr) {
+        out_ << ",\"states\":" << WaitCounts::json(waits.states)
+             << ",\"waits\":" << WaitCounts::json(waits.waits);
+      }
+      out_ << "}\n";
+    }
+  }
+
+  std::chrono::milliseconds interval_;
+  ReportFormat format_;
+  WaitEventSampler *waits_;
+  std::vector<std::unique_ptr<IntervalRecorder>> recorders_;
+
+  // only touched by the reporter thread, and by stop() after it has joined
+  HdrHistogram window_;
+  uint64_t errors_{0};
+  std::chrono::high_resolution_clock::time_point begin_;
+  std::chrono::high_resolution_clock::time_point last_;
+  std::ofstream out_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_{false};
+};
+
+} // namespace pgvectorbench
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PGVECTORBENCH_IO_URING 1
+#endif
+
+namespace pgvectorbench {
+
+namespace util {
+
+struct ReadRequest {
+  char *buffer;
+  size_t n;
+  size_t offset;
+};
+
+#ifdef PGVECTORBENCH_IO_URING
+/*
+ * A minimal io_uring for batches of reads, set up with the raw system calls
+ * so that liburing is not needed.
+ *
+ * A ring is owned by a single thread and has one batch of reads at a time.
+ * start() queues the batch and returns right away, finish() keeps up to the
+ * queue depth of requests in flight, resubmits the rest of short reads and
+ * returns once all of them completed.
+ */
+class IoUring {
+public:
+  explicit IoUring(unsigned queue_depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth, &params));
+    if (fd_ < 0) {
+      return;
+    }
+    entries_ = params.sq_entries;
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cq_ptr_ = single_mmap ? sq_ptr_
+                          : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd_,
+                                 IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes == MAP_FAILED) {
+      sqes_ = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe *>(sqes);
+      release();
+      return;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  ~IoUring() { release(); }
+
+  bool valid() const { return fd_ >= 0; }
+
+  // read every request from fd, those reaching limit may stop short at the
+  // end of the file. 0 on success, a negative errno otherwise.
+  int read(int fd, std::vector<ReadRequest> requests, size_t limit) {
+    int ret = start(fd, std::move(requests), limit);
+    return ret != 0 ? ret : finish();
+  }
+
+  // submit the reads of read without waiting for them, the buffers must not
+  // be touched before finish
+  int start(int fd, std::vector<ReadRequest> requests, size_t limit) {
+    assert(todo_.empty() && in_flight_ == 0);
+    read_fd_ = fd;
+    requests_ = std::move(requests);
+    limit_ = limit;
+    for (size_t i = requests_.size(); i > 0; i--) {
+      todo_.push_back(i - 1);
+    }
+    int ret = enter(fill(), 0);
+    if (ret < 0) {
+      todo_.clear();
+      in_flight_ = 0;
+      return ret;
+    }
+    return 0;
+  }
+
+  // wait for the reads submitted by start
+  int finish() {
+    int error = 0;
+    while (!todo_.empty() || in_flight_ > 0) {
+      int ret = enter(fill(), 1);
+      if (ret < 0) {
+        error = ret;
+        break;
+      }
+      error = reap();
+      if (error != 0) {
+        // the ring is reused, wait for what is still in flight
+        while (in_flight_ > 0) {
+          in_flight_ -= drain();
+        }
+        break;
+      }
+    }
+    todo_.clear();
+    in_flight_ = 0;
+    return error;
+  }
+
+private:
+  void push(int fd, const ReadRequest &request, uint64_t user_data) {
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & sq_mask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(request.buffer);
+    sqe->len = static_cast<uint32_t>(request.n);
+    sqe->off = request.offset;
+    sqe->user_data = user_data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  // submit to_submit queued requests and wait for min_complete completions,
+  // the number submitted or a negative errno
+  int enter(unsigned to_submit, unsigned min_complete) {
+    int ret;
+    do {
+      ret = static_cast<int>(
+          syscall(__NR_io_uring_enter, fd_, to_submit, min_complete,
+                  min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+  }
+
+  // queue the next requests of the batch as long as there is room, the
+  // number queued
+  unsigned fill() {
+    unsigned queued = 0;
+    while (!todo_.empty() && in_flight_ < entries_) {
+      push(read_fd_, requests_[todo_.back()], todo_.back());
+      todo_.pop_back();
+      queued++;
+      in_flight_++;
+    }
+    return queued;
+  }
+
+  // account for the completions there are, short reads are queued again for
+  // the rest. 0 or the error of a failed read.
+  int reap() {
+    int error = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      in_flight_--;
+      ReadRequest &request = requests_[cqe.user_data];
+      if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+        todo_.push_back(cqe.user_data);
+      } else if (cqe.res < 0) {
+        error = cqe.res;
+      } else if (static_cast<size_t>(cqe.res) < request.n) {
+        request.buffer += cqe.res;
+        request.n -= cqe.res;
+        request.offset += cqe.res;
+        if (cqe.res == 0 || request.offset >= limit_) {
+          if (request.offset < limit_) {
+            error = -EIO;
+          }
+        } else {
+          todo_.push_back(cqe.user_data);
+        }
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return error;
+  }
+
+  // wait for at least one completion and drop all that are there
+  unsigned drain() {
+    enter(0, 1);
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    __atomic_store_n(cq_head_, tail, __ATOMIC_RELEASE);
+    return tail - head;
+  }
+
+  void release() {
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+      munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED && sq_ptr_ != nullptr) {
+      munmap(sq_ptr_, sq_size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    sqes_ = nullptr;
+    cq_ptr_ = sq_ptr_ = nullptr;
+    fd_ = -1;
+  }
+
+  int fd_{-1};
+  unsigned entries_{0};
+  void *sq_ptr_{nullptr};
+  void *cq_ptr_{nullptr};
+  size_t sq_size_{0};
+  size_t cq_size_{0};
+  size_t sqes_size_{0};
+  io_uring_sqe *sqes_{nullptr};
+  unsigned *sq_tail_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned *sq_array_{nullptr};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  io_uring_cqe *cqes_{nullptr};
+
+  // the batch in flight
+  int read_fd_{-1};
+  std::vector<ReadRequest> requests_;
+  std::vector<size_t> todo_; // requests not yet submitted, last one first
+  unsigned in_flight_{0};
+  size_t limit_{0};
+};
+#else
+// io_uring is not available on this platform, valid() is always false
+class IoUring {
+public:
+  explicit IoUring(unsigned) {}
+  bool valid() const { return false; }
+  int read(int, std::vector<ReadRequest>, size_t) { return -ENOSYS; }
+  int start(int, std::vector<ReadRequest>, size_t) { return -ENOSYS; }
+  int finish() { return -ENOSYS; }
+};
+#endif
+
+} // namespace util
+
+} // namespace pgvectorbench
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "utils/file_reader.h"
+
+namespace pgvectorbench {
+
+/*
+ * Query vectors, dim floats each, along with the ids of the top_k ground
+ * truth neighbors of every query sorted ascending, top_k per query, and
+ * optionally their distances closest first. All are flat arrays, either
+ * owned or pointing into a mapped cache file.
+ */
+struct QuerySet {
+  size_t count{0};
+  size_t dim{0};
+  size_t top_k{0};
+  const float *vectors{nullptr};
+  const int64_t *gts{nullptr};
+  const float *dists{nullptr};
+
+  const float *vector(size_t i) const { return vectors + i * dim; }
+  const int64_t *gt(size_t i) const { return gts + i * top_k; }
+  const float *dist(size_t i) const { return dists + i * top_k; }
+
+  void own(std::vector<float> vecs, std::vector<int64_t> ids, size_t d,
+           size_t k) {
+    vector_storage = std::move(vecs);
+    gt_storage = std::move(ids);
+    dim = d;
+    top_k = k;
+    count = vector_storage.size() / dim;
+    vectors = vector_storage.data();
+    gts = gt_storage.data();
+  }
+
+  void ownDistances(std::vector<float> distances) {
+    dist_storage = std::move(distances);
+    dists = dist_storage.data();
+  }
+
+  std::vector<float> vector_storage;
+  std::vector<int64_t> gt_storage;
+  std::vector<float> dist_storage;
+  std::unique_ptr<util::FileReader> mapping;
+};
+
+namespace util {
+
+/*
+ * A QuerySet saved in one file that later runs map instead of parsing the
+ * query and ground truth files again.
+ *
+ * The fingerprint covers whatever the content was derived from, a cache
+ * file with a different one is stale and gets rewritten.
+ */
+class QueryCache {
+public:
+  QueryCache(const std::string &path, uint64_t fingerprint)
+      : path_(path), fingerprint_(fingerprint) {}
+
+  const std::string &path() const { return path_; }
+
+  // map the cache file into qs, false if it is missing or stale
+  bool load(QuerySet &qs) const {
+    struct stat st;
+    if (stat(path_.c_str(), &st) != 0) {
+      return false;
+    }
+    auto reader =
+        std::make_unique<FileReader>(path_, ReadOptions{ReadMode::MMAP});
+    try {
+      reader->open();
+    } catch (const std::runtime_error &) {
+      return false;
+    }
+    if (reader->filesize() < sizeof(Header)) {
+      return false;
+    }
+    Header header;
+    memcpy(&header, reader->view(0, sizeof(Header)), sizeof(Header));
+    const size_t gts_size = header.count * header.top_k * sizeof(int64_t);
+    const size_t dists_size = header.count * header.top_k * sizeof(float);
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.fingerprint != fingerprint_ ||
+        reader->filesize() < header.gts_offset + gts_size ||
+        reader->filesize() < header.dists_offset + dists_size) {
+      return false;
+    }
+
+    qs.count = header.count;
+    qs.dim = header.dim;
+    qs.top_k = header.top_k;
+    qs.vectors = reinterpret_cast<const float *>(reader->view(
+        header.vectors_offset, header.count * header.dim * sizeof(float)));
+    qs.gts = reinterpret_cast<const int64_t *>(
+        reader->view(header.gts_offset, gts_size));
+    if (header.dists_offset != 0) {
+      qs.dists = reinterpret_cast<const float *>(
+          reader->view(header.dists_offset, dists_size));
+    }
+    qs.mapping = std::move(reader);
+    return true;
+  }
+
+  // write qs to a temporary file and move it in place, so that concurrent
+  // runs never map a half written cache
+  bool store(const QuerySet &qs) const {
+    Header header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.fingerprint = fingerprint_;
+    header.count = qs.count;
+    header.dim = qs.dim;
+    header.top_k = qs.top_k;
+    header.vectors_offset = sizeof(Header);
+    header.gts_offset =
+        align8(header.vectors_offset + qs.count * qs.dim * sizeof(float));
+    if (qs.dists != nullptr) {
+      header.dists_offset =
+          header.gts_offset + qs.count * qs.top_k * sizeof(int64_t);
+    }
+
+    std::string tmp_path = path_ + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+      if (!out) {
+        return false;
+      }
+      out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+      out.write(reinterpret_cast<const char *>(qs.vectors),
+                qs.count * qs.dim * sizeof(float));
+      const char padding[8] = {0};
+      out.write(padding, header.gts_offset - header.vectors_offset -
+                             qs.count * qs.dim * sizeof(float));
+      out.write(reinterpret_cast<const char *>(qs.gts),
+                qs.count * qs.top_k * sizeof(int64_t));
+      if (qs.dists != nullptr) {
+        out.write(reinterpret_cast<const char *>(qs.dists),
+                  qs.count * qs.top_k * sizeof(float));
+      }
+      if (!out) {
+        std::remove(tmp_path.c_str());
+        return false;
+      }
+    }
+    return std::rename(tmp_path.c_str(), path_.c_str()) == 0;
+  }
+
+  // FNV-1a, only used to tell inputs apart
+  static uint64_t hash(const std::string &data, uint64_t seed = 0) {
+    uint64_t h = 14695981039346656037ULL ^ seed;
+    for (unsigned char c : data) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  // size and modification time of a file, empty if it does not exist
+  static std::string fileStamp(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      return "";
+    }
+    return std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+  }
+
+private:
+  static constexpr char cache_magic[8] = {'P', 'G', 'V', 'B',
+                                          'Q', 'C', '0', '1'};
+
+  struct Header {
+    char magic[8];
+    uint64_t fingerprint;
+    uint64_t count;
+    uint64_t dim;
+    uint64_t top_k;
+    uint64_t vectors_offset;
+    uint64_t gts_offset;
+    uint64_t dists_offset{0}; // 0 if no distances are stored
+  };
+  static_assert(sizeof(Header) == 64);
+
+  static uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t{7}; }
+
+  std::string path_;
+  uint64_t fingerprint_;
+};
+
+} // namespace util
+
+} // namespace pgvectorbench
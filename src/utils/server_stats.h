@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cctype>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <libpq-fe.h>
+#include <spdlog/spdlog.h>
+
+#include "utils/client_factory.h"
+#include "utils/util.h"
+
+namespace pgvectorbench {
+
+namespace util {
+
+/*
+ * Server side counters of one benchmark phase.
+ *
+ * A snapshot is taken before and after the phase, each counter is read from
+ * pg_stat_statements, pg_stat_io (pg_stat_bgwriter before 16),
+ * pg_statio_user_tables, pg_statio_user_indexes and the WAL insert position.
+ * Sources the server does not offer, pg_stat_statements without the
+ * extension and the WAL position on a standby, are skipped with a warning.
+ *
+ * Counters are cumulative over the whole server apart from the table and
+ * index ones and pg_stat_statements, which is narrowed down to statements
+ * mentioning the benchmark table, so other load on a shared server shows up
+ * in the io and wal deltas.
+ */
+class ServerStats {
+public:
+  using Snapshot = std::map<std::string, double>;
+
+  ServerStats(std::unique_ptr<Client> client, const std::string &table_name)
+      : client_(std::move(client)), table_name_(table_name) {
+    // probe the sources once, so that snapshots only run statements that
+    // succeed
+    client_->executeQuery(
+        "SELECT current_setting('server_version_num')::int, "
+        "pg_is_in_recovery(), EXISTS (SELECT 1 FROM pg_extension WHERE "
+        "extname = 'pg_stat_statements')",
+        [&](PGresult *res) {
+          server_version_ = std::stoi(PQgetvalue(res, 0, 0));
+          in_recovery_ = PQgetvalue(res, 0, 1)[0] == 't';
+          has_statements_ = PQgetvalue(res, 0, 2)[0] == 't';
+          return true;
+        });
+    if (!has_statements_) {
+      SPDLOG_WARN("pg_stat_statements is not installed, statement stats are "
+                  "not reported");
+    }
+    if (in_recovery_) {
+      SPDLOG_WARN("server is in recovery, wal stats are not reported");
+    }
+    before_ = snapshot();
+  }
+
+  // snapshot before a phase if server_stats is given, nullptr otherwise
+  static std::unique_ptr<ServerStats>
+  create(const ClientFactory *cf,
+         const std::unordered_map<std::string, std::string> &opt_map,
+         const std::string &default_table_name) {
+    auto ss = Util::getValueFromMap(opt_map, "server_stats");
+    if (!ss.has_value() || !Util::isYes(ss.value())) {
+      return nullptr;
+    }
+    auto client = cf->createClient();
+    if (client == nullptr) {
+      SPDLOG_ERROR("server_stats needs a connection");
+      std::exit(1);
+    }
+    auto table_name = Util::getValueFromMap(opt_map, "table_name");
+    return std::make_unique<ServerStats>(
+        std::move(client), table_name.value_or(default_table_name));
+  }
+
+  // snapshot after the phase and log the deltas
+  void report(const std::string &phase) {
+    // backends of the phase flush their counters when they exit, which
+    // happens asynchronously to closing the connections
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    Snapshot after = snapshot();
+    Snapshot delta;
+    for (const auto &[key, value] : after) {
+      auto it = before_.find(key);
+      delta[key] = value - (it == before_.end() ? 0.0 : it->second);
+    }
+    auto get = [&](const std::string &key) {
+      auto it = delta.find(key);
+      return it == delta.end() ? 0.0 : it->second;
+    };
+    auto hitRatio = [](double hit, double read) {
+      return hit + read > 0 ? hit * 100.0 / (hit + read) : 0.0;
+    };
+
+    if (delta.count("statements.calls")) {
+      double calls = get("statements.calls");
+      SPDLOG_INFO("[{}] statements: {} calls, mean exec time {:.3f} ms, "
+                  "shared blocks {} hit / {} read ({:.2f}% hit)",
+                  phase, calls,
+                  calls > 0 ? get("statements.exec_ms") / calls : 0.0,
+                  get("statements.shared_hit"), get("statements.shared_read"),
+                  hitRatio(get("statements.shared_hit"),
+                           get("statements.shared_read")));
+    }
+    if (delta.count("table.heap_hit")) {
+      double rows = get("table.inserted");
+      double scans = get("table.idx_scan");
+      double idx_blocks = get("table.idx_hit") + get("table.idx_read");
+      SPDLOG_INFO("[{}] table {}: heap blocks {} hit / {} read, index blocks "
+                  "{} hit / {} read, {} rows inserted, {} index scans "
+                  "({:.1f} index blocks per scan), {} seq scans",
+                  phase, table_name_, get("table.heap_hit"),
+                  get("table.heap_read"), get("table.idx_hit"),
+                  get("table.idx_read"), rows, scans,
+                  scans > 0 ? idx_blocks / scans : 0.0,
+                  get("table.seq_scan"));
+      for (const auto &[key, value] : delta) {
+        if (key.rfind("index.", 0) != 0 ||
+            key.compare(key.size() - 4, 4, ".hit") != 0) {
+          continue;
+        }
+        std::string name = key.substr(6, key.size() - 10);
+        SPDLOG_INFO("[{}] index {}: {} hit / {} read", phase, name, value,
+                    get("index." + name + ".read"));
+      }
+    }
+    if (delta.count("io.reads")) {
+      SPDLOG_INFO("[{}] io: {} reads, {} hits, {} writes, {} extends, {} "
+                  "evictions",
+                  phase, get("io.reads"), get("io.hits"), get("io.writes"),
+                  get("io.extends"), get("io.evictions"));
+    } else if (delta.count("bgwriter.buffers_alloc")) {
+      SPDLOG_INFO("[{}] bgwriter: {} buffers allocated, {} cleaned", phase,
+                  get("bgwriter.buffers_alloc"),
+                  get("bgwriter.buffers_clean"));
+    }
+    if (delta.count("wal.bytes")) {
+      double bytes = get("wal.bytes");
+      double rows = get("table.inserted");
+      SPDLOG_INFO("[{}] wal: {:.2f} MiB, {:.1f} bytes per inserted row", phase,
+                  bytes / (1024 * 1024), rows > 0 ? bytes / rows : 0.0);
+    }
+  }
+
+private:
+  Snapshot snapshot() {
+    Snapshot snap;
+    std::string table = quote(table_name_);
+    std::vector<std::pair<std::string, std::string>> sources = {
+        {"table",
+         "SELECT coalesce(io.heap_blks_hit, 0) AS heap_hit, "
+         "coalesce(io.heap_blks_read, 0) AS heap_read, "
+         "coalesce(io.idx_blks_hit, 0) AS idx_hit, "
+         "coalesce(io.idx_blks_read, 0) AS idx_read, "
+         "st.n_tup_ins AS inserted, coalesce(st.idx_scan, 0) AS idx_scan, "
+         "st.seq_scan AS seq_scan FROM pg_statio_user_tables io JOIN "
+         "pg_stat_user_tables st USING (relid) WHERE relid = to_regclass(" +
+             table + ")"},
+    };
+    if (has_statements_) {
+      // exclude the statements of this class, which mention the table too
+      sources.emplace_back(
+          "statements",
+          "SELECT coalesce(sum(calls), 0) AS calls, "
+          "coalesce(sum(total_exec_time), 0) AS exec_ms, "
+          "coalesce(sum(shared_blks_hit), 0) AS shared_hit, "
+          "coalesce(sum(shared_blks_read), 0) AS shared_read "
+          "FROM pg_stat_statements WHERE dbid = (SELECT oid FROM pg_database "
+          "WHERE datname = current_database()) AND query ~* " +
+              quote(wordPattern(table_name_)) +
+              " AND query NOT ILIKE '%pg\\_stat%'");
+    }
+    if (server_version_ >= 160000) {
+      sources.emplace_back(
+          "io", "SELECT coalesce(sum(reads), 0) AS reads, "
+                "coalesce(sum(hits), 0) AS hits, "
+                "coalesce(sum(writes), 0) AS writes, "
+                "coalesce(sum(extends), 0) AS extends, "
+                "coalesce(sum(evictions), 0) AS evictions FROM pg_stat_io");
+    } else {
+      sources.emplace_back(
+          "bgwriter",
+          "SELECT buffers_alloc, buffers_clean FROM pg_stat_bgwriter");
+    }
+    if (!in_recovery_) {
+      sources.emplace_back(
+          "wal",
+          "SELECT pg_wal_lsn_diff(pg_current_wal_lsn(), '0/0') AS bytes");
+    }
+
+    for (const auto &[source, sql] : sources) {
+      client_->executeQuery(sql.c_str(), [&](PGresult *res) {
+        // no row if the table does not exist yet
+        if (PQntuples(res) == 0) {
+          return true;
+        }
+        for (int j = 0; j < PQnfields(res); j++) {
+          snap[source + "." + PQfname(res, j)] = value(res, 0, j);
+        }
+        return true;
+      });
+    }
+
+    // one pair of counters per index of the table
+    client_->executeQuery(
+        ("SELECT indexrelname, idx_blks_hit, idx_blks_read "
+         "FROM pg_statio_user_indexes WHERE relid = to_regclass(" +
+         table + ")")
+            .c_str(),
+        [&](PGresult *res) {
+          for (int i = 0; i < PQntuples(res); i++) {
+            std::string prefix = std::string("index.") + PQgetvalue(res, i, 0);
+            snap[prefix + ".hit"] = value(res, i, 1);
+            snap[prefix + ".read"] = value(res, i, 2);
+          }
+          return true;
+        });
+    return snap;
+  }
+
+  static double value(PGresult *res, int row, int col) {
+    return PQgetisnull(res, row, col) ? 0.0
+                                      : std::stod(PQgetvalue(res, row, col));
+  }
+
+  // a regular expression matching name as a whole word, so that items does
+  // not match items_2 or line_items
+  static std::string wordPattern(const std::string &name) {
+    std::string pattern = "\\m";
+    for (char c : name) {
+      if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+        pattern += '\\';
+      }
+      pattern += c;
+    }
+    return pattern + "\\M";
+  }
+
+  static std::string quote(const std::string &literal) {
+    std::string quoted = "'";
+    for (char c : literal) {
+      quoted += c;
+      if (c == '\'') {
+        quoted += c;
+      }
+    }
+    return quoted + "'";
+  }
+
+  std::unique_ptr<Client> client_;
+  std::string table_name_;
+  int server_version_{0};
+  bool in_recovery_{false};
+  bool has_statements_{false};
+  Snapshot before_;
+};
+
+} // namespace util
+
+} // namespace pgvectorbench
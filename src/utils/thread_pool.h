@@ -1,117 +1,284 @@
-// Adapted from https://github.com/progschj/ThreadPool
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <cassert>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
-#include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
-#include <stdexcept>
 #include <thread>
 #include <vector>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace pgvectorbench {
+
+/*
+ * A work stealing thread pool.
+ *
+ * Every worker owns a deque, tasks submitted from a worker go to its own
+ * deque, the others are spread round robin. A worker pops from the back of
+ * its deque and, once that is empty, steals from the front of the others, so
+ * producers never contend on one queue lock.
+ *
+ * Tasks get the index of the worker running them, which stays the same for
+ * the life of the pool and can be used to pick per worker state such as read
+ * buffers. Workers are optionally pinned to one CPU each, picked among those
+ * the process is allowed to run on.
+ */
 class ThreadPool {
 public:
-  ThreadPool(size_t);
-  template <class F, class... Args>
-  auto enqueue(F &&f, Args &&...args)
-      -> std::future<typename std::invoke_result<F, Args...>::type>;
-  ~ThreadPool();
+  using Task = std::function<void(size_t worker)>;
 
-  void task_complete();
+  explicit ThreadPool(size_t threads, bool pin_threads = false)
+      : queues_(threads) {
+    for (size_t i = 0; i < threads; i++) {
+      queues_[i] = std::make_unique<WorkQueue>();
+    }
+    std::vector<int> cpus = pin_threads ? allowedCpus() : std::vector<int>();
+    bool pinned = true;
+    for (size_t i = 0; i < threads; i++) {
+      workers_.emplace_back([this, i]() { run(i); });
+      if (pin_threads) {
+        pinned = pin(workers_.back(), cpus, i) && pinned;
+      }
+    }
+    if (!pinned) {
+      SPDLOG_WARN("failed to pin the workers of the thread pool to CPUs");
+    }
+  }
 
-  void wait_all_tasks_finished();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
 
-private:
-  // need to keep track of threads so we can join them
-  std::vector<std::thread> workers;
-  // the task queue
-  std::queue<std::function<void()>> tasks;
-
-  // synchronization
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  std::condition_variable condition_finished;
-  bool stop;
-
-  std::atomic<size_t> tasks_added{0};
-  std::atomic<size_t> tasks_executed{0};
-  std::atomic<bool> all_tasks_added;
-};
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
 
-// the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads)
-    : stop(false), all_tasks_added(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty())
-            return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
+  size_t size() const { return workers_.size(); }
 
-        task();
-        task_complete();
+  void submit(Task task) {
+    unfinished_.fetch_add(1);
+    size_t target = current_pool_ == this ? current_worker_ : nextQueue();
+    {
+      std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+      queues_[target]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    wake(false);
+  }
+
+  // spread tasks over the workers in contiguous runs, taking every deque
+  // lock once
+  void submit(std::vector<Task> tasks) {
+    if (tasks.empty()) {
+      return;
+    }
+    unfinished_.fetch_add(tasks.size());
+    const size_t n = queues_.size();
+    const size_t first = nextQueue();
+    for (size_t q = 0; q < n; q++) {
+      size_t begin = tasks.size() * q / n;
+      size_t end = tasks.size() * (q + 1) / n;
+      if (begin == end) {
+        continue;
+      }
+      auto &queue = *queues_[(first + q) % n];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      for (size_t i = begin; i < end; i++) {
+        queue.tasks.push_back(std::move(tasks[i]));
       }
-    });
-}
+    }
+    queued_.fetch_add(tasks.size());
+    wake(true);
+  }
 
-// add new work item to the pool
-template <class F, class... Args>
-auto ThreadPool::enqueue(F &&f, Args &&...args)
-    -> std::future<typename std::invoke_result<F, Args...>::type> {
-  using return_type = typename std::invoke_result<F, Args...>::type;
+  // run fn(worker, i) for i in [0, n) split into about one chunk per worker
+  // and wait for all of them, not to be called from a task of this pool
+  void parallelFor(size_t n,
+                   const std::function<void(size_t worker, size_t i)> &fn) {
+    assert(current_pool_ != this);
+    std::vector<Task> tasks;
+    const size_t chunks = std::min(n, size());
+    for (size_t c = 0; c < chunks; c++) {
+      tasks.emplace_back([&fn, n, chunks, c](size_t worker) {
+        for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++) {
+          fn(worker, i);
+        }
+      });
+    }
+    submit(std::move(tasks));
+    wait();
+  }
+
+  // block until every task submitted so far has run, the first exception
+  // thrown by any of them is rethrown here. A task of this pool waiting for
+  // it would wait for itself.
+  void wait() {
+    assert(current_pool_ != this);
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_cv_.wait(lock, [this] { return unfinished_.load() == 0; });
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
 
-  auto task = std::make_shared<std::packaged_task<return_type()>>(
-      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  void run(size_t id) {
+    current_pool_ = this;
+    current_worker_ = id;
+    for (;;) {
+      Task task;
+      if (pop(id, task) || steal(id, task)) {
+        queued_.fetch_sub(1);
+        try {
+          task(id);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(done_mutex_);
+          if (!error_) {
+            error_ = std::current_exception();
+          }
+        }
+        if (unfinished_.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(done_mutex_);
+          done_cv_.notify_all();
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      sleepers_.fetch_add(1);
+      sleep_cv_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+      sleepers_.fetch_sub(1);
+      if (stop_ && queued_.load() <= 0) {
+        return;
+      }
+    }
+  }
 
-  std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+  bool pop(size_t id, Task &task) {
+    auto &queue = *queues_[id];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
 
-    // don't allow enqueueing after stopping the pool
-    if (stop || all_tasks_added)
-      throw std::runtime_error("enqueue on stopped ThreadPool");
+  bool steal(size_t id, Task &task) {
+    for (size_t k = 1; k < queues_.size(); k++) {
+      auto &queue = *queues_[(id + k) % queues_.size()];
+      std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+      if (!lock.owns_lock() || queue.tasks.empty()) {
+        continue;
+      }
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
 
-    tasks.emplace([task]() { (*task)(); });
-    tasks_added.fetch_add(1);
+  // A worker counts itself in sleepers_ before it checks queued_, and the
+  // submitter increments queued_ before it checks sleepers_, so either the
+  // worker sees the task or the submitter sees the worker. Only then is the
+  // sleep mutex taken, to notify a worker that is about to wait.
+  void wake(bool all) {
+    if (sleepers_.load() == 0) {
+      return;
+    }
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    if (all) {
+      sleep_cv_.notify_all();
+    } else {
+      sleep_cv_.notify_one();
+    }
   }
-  condition.notify_one();
-  return res;
-}
-
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool() {
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    stop = true;
+
+  size_t nextQueue() { return next_queue_.fetch_add(1) % queues_.size(); }
+
+  // the CPUs of the affinity mask of the process, which taskset or a cgroup
+  // cpuset may narrow down
+  static std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+#endif
+    return cpus;
   }
-  condition.notify_all();
-  for (std::thread &worker : workers)
-    worker.join();
-}
-
-inline void ThreadPool::task_complete() {
-  tasks_executed.fetch_add(1);
-  if (all_tasks_added.load() && tasks_executed.load() == tasks_added.load()) {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    condition_finished.notify_all();
+
+  static bool pin(std::thread &thread, const std::vector<int> &cpus,
+                  size_t id) {
+#ifdef __linux__
+    if (cpus.empty()) {
+      return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[id % cpus.size()], &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) ==
+           0;
+#else
+    (void)thread;
+    (void)cpus;
+    (void)id;
+    return false;
+#endif
   }
-}
-
-inline void ThreadPool::wait_all_tasks_finished() {
-  std::unique_lock<std::mutex> lock(queue_mutex);
-  all_tasks_added = true;
-  condition_finished.wait(lock, [this] {
-    return this->tasks_executed.load() == this->tasks_added.load();
-  });
-}
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_queue_{0};
+
+  // tasks sitting in a deque, may dip below zero while a task is taken
+  // before its submitter counted it
+  std::atomic<int64_t> queued_{0};
+  // workers waiting on sleep_cv_ or about to
+  std::atomic<size_t> sleepers_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool stop_{false};
+
+  // tasks submitted and not yet finished
+  std::atomic<size_t> unfinished_{0};
+  std::mutex done_mutex_;
+  std::condition_variable done_cv_;
+  std::exception_ptr error_;
+
+  static inline thread_local ThreadPool *current_pool_{nullptr};
+  static inline thread_local size_t current_worker_{0};
+};
+
+} // namespace pgvectorbench
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace pgvectorbench {
 
@@ -20,6 +24,58 @@ public:
       return std::nullopt;
     }
   }
+
+  // yes/y/true (case insensitive) turns a boolean option on
+  static bool isYes(const std::string &value) {
+    std::string lowercase = value;
+    std::transform(lowercase.begin(), lowercase.end(), lowercase.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return lowercase == "yes" || lowercase == "y" || lowercase == "true";
+  }
+
+  // parse a duration such as 500ms, 30s, 10m or 1h, plain numbers are seconds
+  static std::chrono::milliseconds parseDuration(const std::string &value) {
+    size_t pos = 0;
+    double number = std::stod(value, &pos);
+    std::string unit = value.substr(pos);
+    double ms;
+    if (unit.empty() || unit == "s") {
+      ms = number * 1000;
+    } else if (unit == "ms") {
+      ms = number;
+    } else if (unit == "m" || unit == "min") {
+      ms = number * 60 * 1000;
+    } else if (unit == "h") {
+      ms = number * 60 * 60 * 1000;
+    } else {
+      throw std::runtime_error("unknown duration unit: " + value);
+    }
+    return std::chrono::milliseconds(static_cast<int64_t>(ms));
+  }
+
+  // escape value to be put between double quotes in a JSON string
+  static std::string jsonEscape(const std::string &value) {
+    static const char hex[] = "0123456789abcdef";
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (unsigned char c : value) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+        escaped += c;
+      } else if (c == '\n') {
+        escaped += "\\n";
+      } else if (c == '\t') {
+        escaped += "\\t";
+      } else if (c < 0x20) {
+        escaped += "\\u00";
+        escaped += hex[c >> 4];
+        escaped += hex[c & 0xf];
+      } else {
+        escaped += c;
+      }
+    }
+    return escaped;
+  }
 };
 
 template <typename T> class Percentile {
@@ -98,4 +154,20 @@ private:
   }
 };
 
+// works for Percentile and anything else exposing best/worst/average/P(x)
+template <typename P>
+std::string
+percentile2str(P &p,
+               const std::vector<std::pair<std::string, double>> &percentages) {
+  std::ostringstream oss;
+  oss << "best=" << p.best() << " worst=" << p.worst()
+      << " average=" << p.average();
+
+  for (auto it = percentages.begin(); it != percentages.end(); it++) {
+    oss << " P(" << it->first << "%)=" << p(it->second);
+  }
+
+  return oss.str();
+}
+
 } // namespace pgvectorbench
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <libpq-fe.h>
+#include <spdlog/spdlog.h>
+
+#include "utils/client_factory.h"
+#include "utils/util.h"
+
+namespace pgvectorbench {
+
+// backend samples of one window, keyed by state and by wait event
+struct WaitCounts {
+  uint64_t polls{0};
+  std::map<std::string, uint64_t> states;
+  // wait_event_type:wait_event of active backends, CPU if they do not wait
+  std::map<std::string, uint64_t> waits;
+
+  void merge(const WaitCounts &other) {
+    polls += other.polls;
+    for (const auto &[key, n] : other.states) {
+      states[key] += n;
+    }
+    for (const auto &[key, n] : other.waits) {
+      waits[key] += n;
+    }
+  }
+
+  // most frequent first, as percentages of all entries
+  static std::string top(const std::map<std::string, uint64_t> &counts,
+                         size_t limit = 8) {
+    std::vector<std::pair<std::string, uint64_t>> sorted(counts.begin(),
+                                                         counts.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto &a, const auto &b) { return a.second > b.second; });
+    uint64_t total = 0;
+    for (const auto &entry : sorted) {
+      total += entry.second;
+    }
+    std::string out;
+    for (size_t i = 0; i < sorted.size() && i < limit; i++) {
+      out += fmt::format("{}{} {:.1f}%", i > 0 ? ", " : "", sorted[i].first,
+                         sorted[i].second * 100.0 / total);
+    }
+    return out.empty() ? "none" : out;
+  }
+
+  // key=count pairs separated by semicolons, fits in one csv field
+  static std::string csv(const std::map<std::string, uint64_t> &counts) {
+    std::string out;
+    for (const auto &[key, n] : counts) {
+      out += fmt::format("{}{}={}", out.empty() ? "" : ";", key, n);
+    }
+    return out;
+  }
+
+  static std::string json(const std::map<std::string, uint64_t> &counts) {
+    std::string out = "{";
+    for (const auto &[key, n] : counts) {
+      out += fmt::format("{}\"{}\":{}", out.size() > 1 ? "," : "",
+                         Util::jsonEscape(key), n);
+    }
+    return out + "}";
+  }
+};
+
+/*
+ * Samples the state and wait event of the backends of the benchmark from
+ * pg_stat_activity on a background thread.
+ *
+ * Backends are told apart by the application_name of the client factory,
+ * the connection of the sampler itself is left out. The counts are kept for
+ * the whole phase and for the current window of the interval reporter.
+ */
+class WaitEventSampler {
+public:
+  WaitEventSampler(std::unique_ptr<Client> client,
+                   const std::string &application_name,
+                   std::chrono::milliseconds interval)
+      : client_(std::move(client)), interval_(interval) {
+    query_ = "SELECT state, wait_event_type, wait_event FROM pg_stat_activity "
+             "WHERE pid <> pg_backend_pid() AND application_name = '";
+    for (char c : application_name) {
+      query_ += c;
+      if (c == '\'') {
+        query_ += c;
+      }
+    }
+    query_ += "'";
+  }
+
+  ~WaitEventSampler() { stop(); }
+
+  // a sampler if wait_sample_interval is given, nullptr otherwise
+  static std::unique_ptr<WaitEventSampler>
+  create(const ClientFactory *cf,
+         const std::unordered_map<std::string, std::string> &opt_map) {
+    auto wi = Util::getValueFromMap(opt_map, "wait_sample_interval");
+    if (!wi.has_value()) {
+      return nullptr;
+    }
+    auto interval = Util::parseDuration(wi.value());
+    if (interval.count() <= 0) {
+      SPDLOG_ERROR("Illegal wait_sample_interval value: {}", wi.value());
+      std::exit(1);
+    }
+    auto client = cf->createClient();
+    if (client == nullptr) {
+      SPDLOG_ERROR("wait_sample_interval needs a connection");
+      std::exit(1);
+    }
+    return std::make_unique<WaitEventSampler>(std::move(client),
+                                              cf->applicationName(), interval);
+  }
+
+  void start() {
+    thread_ = std::thread([this]() { run(); });
+  }
+
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // counts since the previous call
+  WaitCounts drainWindow() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_.merge(window_);
+    WaitCounts window = std::move(window_);
+    window_ = WaitCounts();
+    return window;
+  }
+
+  // log the states and wait events of the whole phase
+  void report(const std::string &phase) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    WaitCounts total = total_;
+    total.merge(window_);
+    uint64_t samples = 0;
+    for (const auto &[key, n] : total.states) {
+      samples += n;
+    }
+    SPDLOG_INFO("[{}] {} backend samples in {} polls every {} ms", phase,
+                samples, total.polls, interval_.count());
+    SPDLOG_INFO("[{}] backend states: {}", phase,
+                WaitCounts::top(total.states));
+    SPDLOG_INFO("[{}] waits of active backends: {}", phase,
+                WaitCounts::top(total.waits));
+  }
+
+private:
+  void run() {
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+      lock.unlock();
+      WaitCounts sample = poll();
+      lock.lock();
+      window_.merge(sample);
+      next += interval_;
+      cv_.wait_until(lock, next, [this] { return stopped_; });
+    }
+  }
+
+  WaitCounts poll() {
+    WaitCounts sample;
+    sample.polls = 1;
+    client_->executeQuery(query_.c_str(), [&](PGresult *res) {
+      for (int i = 0; i < PQntuples(res); i++) {
+        std::string state =
+            PQgetisnull(res, i, 0) ? "unknown" : PQgetvalue(res, i, 0);
+        sample.states[state]++;
+        if (state != "active") {
+          continue;
+        }
+        if (PQgetisnull(res, i, 1)) {
+          sample.waits["CPU"]++;
+        } else {
+          sample.waits[std::string(PQgetvalue(res, i, 1)) + ":" +
+                       PQgetvalue(res, i, 2)]++;
+        }
+      }
+      return true;
+    });
+    return sample;
+  }
+
+  std::unique_ptr<Client> client_;
+  std::chrono::milliseconds interval_;
+  std::string query_;
+
+  // the window is moved into the total when drained
+  WaitCounts window_;
+  WaitCounts total_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_{false};
+};
+
+} // namespace pgvectorbench